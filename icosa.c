@@ -2,147 +2,1739 @@
  * Inspired by the 2nd Reality demo (Future Crew, 1993).
  * The shape is a tetrakis hexahedron rendered as a translucent wireframe
  * with physics-based bouncing and squash-and-stretch deformation.
+ * This is the terminal front end; the drawing lives in libicosa.c.
  */
 
+#include "icosa.h"
+
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
-/* Tetrakis hexahedron: cube + pyramid on each face */
-#define NVERTS 14
-#define NEDGES 36
-#define PYR 1.5f /* pyramid tip distance from center */
-
-static const float base_verts[NVERTS][3] = {
-    /* Cube corners (0-7) */
-    { 1,  1,  1}, { 1,  1, -1}, { 1, -1,  1}, { 1, -1, -1},
-    {-1,  1,  1}, {-1,  1, -1}, {-1, -1,  1}, {-1, -1, -1},
-    /* Pyramid tips: +x, -x, +y, -y, +z, -z (8-13) */
-    {PYR, 0, 0}, {-PYR, 0, 0},
-    {0, PYR, 0}, {0, -PYR, 0},
-    {0, 0, PYR}, {0, 0, -PYR}
+static struct icosa *tv;           /* the terminal, sized on first use */
+static int tcols, trows;           /* current terminal size */
+static struct icosa_state anim;    /* drives whatever is drawn */
+static int repaint;                /* next frame must clear and redraw */
+static int unfocused;              /* the terminal reported losing focus */
+static int hidden;                 /* a background job: output is held back */
+static int out_gone;               /* stdout was closed or hung up */
+static unsigned look;              /* ICOSA_* flags chosen on the command line */
+static unsigned merge = 12;        /* --merge: see icosa_opts */
+static struct termios orig_tios;
+static volatile sig_atomic_t winch;
+static volatile sig_atomic_t stop; /* signal to re-raise once recorded */
+static int headless;               /* --headless: no terminal, virtual time */
+
+/* Recording (--record FILE): the byte stream is saved as asciicast v2,
+ * one "o" event per frame stamped with the time the frame was started.
+ * Events are escaped straight into a large stdio buffer, so recording
+ * costs a copy per frame rather than a write. */
+static struct {
+    FILE *f;
+    double t;             /* timestamp of the frame being produced */
+    int open;             /* an event for this frame has been started */
+} rec;
+
+/* --stats: what reaching the terminal cost, reported on stderr at exit.
+ * Stall is time spent blocked in write(), i.e. waiting for the tty to
+ * drain, which is where a slow link shows up. */
+static struct {
+    int on;
+    long frames;
+    uint64_t bytes;
+    double stall, frame_stall, stall_max; /* seconds */
+    long dropped;         /* frames dropped to pace output */
+} stats;
+
+static double mono_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Flow control. Every frame drawn is followed by a DSR (CSI 6n), which
+ * the terminal answers with a cursor position report only once it has
+ * processed everything before it; unanswered probes are frames still
+ * queued in kernel or SSH buffers. With MAX_IN_FLIGHT of them, frames
+ * are dropped (the animation keeps time) until the terminal catches up,
+ * so on a slow link the picture and the quit key stay within a frame or
+ * two. Nothing is held back until the terminal has answered once, and
+ * one that never does turns probing off. */
+#define MAX_IN_FLIGHT 2
+#define PROBE_TIMEOUT 2.0 /* s: an answer this late is taken as lost */
+#define ESC_WAIT 0.3      /* s: an ESC followed by nothing for this long is a key */
+
+static struct {
+    int on;
+    int answered;               /* the terminal has answered a probe */
+    int inflight, head;         /* unanswered probes, oldest in sent[head] */
+    double sent[MAX_IN_FLIGHT];
+    double rtt, rtt_max;        /* smoothed and worst round trip, s */
+    int esc;                    /* input parser: 0, after ESC, in CSI */
+    double esc_at;              /* when the ESC came */
+} flow;
+
+/* Governor (--cpu-budget PCT, --frame-budget MS). Once a second the CPU
+ * time used is checked against the budgets: over either, quality steps
+ * down a level; under half of both for GOV_CALM seconds running, it steps
+ * back up. The gap between the two thresholds keeps it from hunting
+ * between levels. The levels, in the order they are given up: */
+static const struct {
+    int every;      /* draw one frame in this many */
+    unsigned flags; /* context options */
+} gov_levels[] = {
+    { 1, 0 },
+    { 2, 0 },                                               /* 15 fps */
+    { 2, ICOSA_NO_BACK },                                   /* front edges */
+    { 2, ICOSA_NO_BACK | ICOSA_DIFF },                      /* changes only */
+    { 2, ICOSA_NO_BACK | ICOSA_DIFF | ICOSA_HALF_RES },     /* half resolution */
 };
+#define GOV_LEVELS (int)(sizeof(gov_levels) / sizeof(gov_levels[0]))
+#define GOV_CALM 3
+
+static struct {
+    double cpu;         /* budget: fraction of a core, 0 = none */
+    double frame;       /* budget: CPU seconds per frame drawn, 0 = none */
+    int level;
+    int max_level;      /* --loop frames must all be drawn the same way */
+    int calm;           /* windows in a row well under budget */
+    double t0, cpu0;    /* window start: wall clock and process CPU time */
+    long drawn, drawn0; /* frames drawn, in all and at window start */
+} gov;
 
-static const int edges[NEDGES][2] = {
-    /* Cube edges (12) */
-    {0,1},{0,2},{0,4},{1,3},{1,5},{2,3},{2,6},{3,7},{4,5},{4,6},{5,7},{6,7},
-    /* +x face → tip 8 */  {8,0},{8,1},{8,2},{8,3},
-    /* -x face → tip 9 */  {9,4},{9,5},{9,6},{9,7},
-    /* +y face → tip 10 */ {10,0},{10,1},{10,4},{10,5},
-    /* -y face → tip 11 */ {11,2},{11,3},{11,6},{11,7},
-    /* +z face → tip 12 */ {12,0},{12,2},{12,4},{12,6},
-    /* -z face → tip 13 */ {13,1},{13,3},{13,5},{13,7}
+/* Bandwidth cap (--max-bps N). Output is metered by a token bucket that
+ * fills at N bytes a second, holding at most BPS_BURST seconds' worth; a
+ * frame is only drawn while the bucket isn't in debt, so frames are
+ * dropped (the animation keeps time) to stay under the cap. Each frame
+ * goes out as changes or whole, whichever is smaller, and while more than
+ * a third of frames are being dropped the look steps down, checked once
+ * a second: ASCII instead of braille (a third of the bytes per cell),
+ * then no floor. Once the link has had room to spare for BPS_CALM seconds
+ * running it steps back. */
+static const unsigned bps_levels[] = {
+    ICOSA_DIFF,
+    ICOSA_DIFF | ICOSA_ASCII,
+    ICOSA_DIFF | ICOSA_ASCII | ICOSA_NO_FLOOR,
 };
+#define BPS_LEVELS (int)(sizeof(bps_levels) / sizeof(bps_levels[0]))
+#define BPS_BURST 0.25
+#define BPS_CALM 3
 
-static unsigned char *fb;        /* braille dot framebuffer */
-static unsigned char *floor_map; /* per-cell: 0=sky, 1=dark, 2=light */
-static int cw, ch;
-static int pw, ph;
-static int horizon;
-static char *rbuf;
-static struct termios orig_tios;
+static struct {
+    double rate;          /* bytes a second, 0 = no cap */
+    int shape;            /* frames may be diffs and change look (not --loop) */
+    double tokens, t;     /* the bucket, and when it was last filled */
+    uint64_t charged;     /* out_bytes already taken from the bucket */
+    int level, calm;
+    double t0;            /* window start */
+    uint64_t bytes0;      /* out_bytes at window start */
+    long tried, sent;     /* frames due and frames drawn in the window */
+} bps;
+
+static uint64_t out_bytes; /* everything write_all() has sent */
+
+/* Options for the terminal's context, from the governor and the cap */
+static unsigned view_flags(void) {
+    unsigned f = gov_levels[gov.level].flags | look;
+    if (bps.rate && bps.shape) f |= bps_levels[bps.level];
+    return f;
+}
+
+static void apply_flags(void) {
+    if (tv) icosa_set_flags(tv, view_flags());
+}
+
+/* Whether the bucket is in debt; counts the frame as due either way */
+static int bps_blocked(void) {
+    if (!bps.rate) return 0;
+    double t = mono_now();
+    if (!bps.t) {
+        bps.t = t;
+        bps.tokens = bps.rate * BPS_BURST;
+    }
+    bps.tokens += (t - bps.t) * bps.rate - (double)(out_bytes - bps.charged);
+    if (bps.tokens > bps.rate * BPS_BURST) bps.tokens = bps.rate * BPS_BURST;
+    bps.t = t;
+    bps.charged = out_bytes;
+    bps.tried++;
+    if (bps.tokens < 0) return 1;
+    bps.sent++;
+    return 0;
+}
+
+static void bps_update(void) {
+    if (!bps.rate || !bps.shape) return;
+    double t = mono_now();
+    if (!bps.t0) {
+        bps.t0 = t;
+        bps.bytes0 = out_bytes;
+    }
+    if (t - bps.t0 < 1.0) return;
+
+    double used = (double)(out_bytes - bps.bytes0) / (t - bps.t0);
+    int starved = bps.sent * 3 < bps.tried * 2;
+    bps.calm = !starved && bps.sent == bps.tried && used < bps.rate / 3 ? bps.calm + 1 : 0;
+    if (starved && bps.level < BPS_LEVELS - 1) {
+        bps.level++;
+        apply_flags();
+    } else if (bps.calm >= BPS_CALM && bps.level > 0) {
+        bps.level--;
+        bps.calm = 0;
+        apply_flags();
+    }
+    bps.t0 = t;
+    bps.bytes0 = out_bytes;
+    bps.tried = bps.sent = 0;
+}
+
+static double cpu_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void gov_update(void) {
+    if (!gov.cpu && !gov.frame) return;
+    double t = mono_now(), cpu = cpu_now();
+    if (!gov.t0) {
+        gov.t0 = t;
+        gov.cpu0 = cpu;
+    }
+    if (t - gov.t0 < 1.0) return;
+
+    double use = (cpu - gov.cpu0) / (t - gov.t0);
+    long n = gov.drawn - gov.drawn0;
+    double per = n ? (cpu - gov.cpu0) / n : 0;
+    int over = (gov.cpu && use > gov.cpu) || (gov.frame && per > gov.frame);
+    int calm = (!gov.cpu || use < gov.cpu / 2) && (!gov.frame || per < gov.frame / 2);
+    gov.calm = calm ? gov.calm + 1 : 0;
+    if (over && gov.level < gov.max_level) {
+        gov.level++;
+        apply_flags();
+    } else if (gov.calm >= GOV_CALM && gov.level > 0) {
+        gov.level--;
+        gov.calm = 0;
+        apply_flags();
+    }
+    gov.t0 = t;
+    gov.cpu0 = cpu;
+    gov.drawn0 = gov.drawn;
+}
+
+/* Whether this frame should be dropped rather than drawn */
+static int flow_blocked(void) {
+    if (!flow.on || !flow.inflight) return 0;
+    if (mono_now() - flow.sent[flow.head] > PROBE_TIMEOUT) {
+        if (!flow.answered) flow.on = 0; /* never will */
+        flow.inflight = 0;
+        return 0;
+    }
+    return flow.answered && flow.inflight >= MAX_IN_FLIGHT;
+}
+
+static void flow_answer(void) {
+    if (!flow.inflight) return; /* a late answer to a probe given up on */
+    double rtt = mono_now() - flow.sent[flow.head];
+    flow.head = (flow.head + 1) % MAX_IN_FLIGHT;
+    flow.inflight--;
+    flow.rtt = flow.answered ? flow.rtt * 0.875 + rtt * 0.125 : rtt;
+    if (rtt > flow.rtt_max) flow.rtt_max = rtt;
+    flow.answered = 1;
+}
+
+/* Focus reports (CSI I, CSI O), asked for with mode 1004. Nothing is drawn
+ * while the terminal is out of focus, such as in a background tab or tmux
+ * window, and it is redrawn in full on coming back, since whatever was
+ * shown meanwhile may have disturbed it. */
+static void set_focus(int in) {
+    if (in && unfocused) repaint = 1;
+    unfocused = !in;
+}
+
+/* Read what's waiting on stdin: cursor position reports (CSI row;col R)
+ * answer probes, focus reports are noted, and anything else is a
+ * keypress. Returns 1 if a key was pressed or input has ended. The parser
+ * carries over between reads, since a report can arrive split; an ESC
+ * with nothing after it is left to lone_escape(). */
+static int read_input(void) {
+    unsigned char buf[256];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n == 0) return 1;
+    if (n < 0) return errno != EINTR && errno != EAGAIN;
+    int key = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        unsigned char c = buf[i];
+        if (flow.esc == 2 && ((c >= '0' && c <= '9') || c == ';')) continue;
+        if (flow.esc == 2 && c == 'R') flow_answer();
+        else if (flow.esc == 2 && (c == 'I' || c == 'O')) set_focus(c == 'I');
+        else if (flow.esc == 1 && c == '[') {
+            flow.esc = 2;
+            continue;
+        } else if (c == 0x1b && !flow.esc) {
+            flow.esc = 1;
+            flow.esc_at = mono_now();
+            continue;
+        } else {
+            key = 1;
+        }
+        flow.esc = 0;
+    }
+    return key;
+}
+
+/* The Escape key: an ESC that nothing followed within ESC_WAIT */
+static int lone_escape(void) {
+    return flow.esc == 1 && mono_now() - flow.esc_at >= ESC_WAIT;
+}
+
+static int input_ready(const struct pollfd *pfd) {
+    if (!(pfd->revents & POLLIN)) return pfd->revents != 0;
+    return read_input();
+}
+
+/* Before handing the terminal back, take in answers still on their way so
+ * they don't land in the shell as typed text */
+static void flow_drain(void) {
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    double end = mono_now() + 0.25;
+    while (flow.on && flow.answered && flow.inflight && mono_now() < end) {
+        if (poll(&pfd, 1, 25) <= 0) continue;
+        if (!(pfd.revents & POLLIN)) break;
+        read_input(); /* keys no longer matter */
+    }
+}
+
+/* Shared-memory loops (--shm). The first instance to need a size creates
+ * the segment and publishes frames into it as it encodes them; later ones
+ * map it and stream whatever has been published, rendering the rest
+ * locally. Segments are per user, so nobody's terminal receives bytes
+ * another account wrote. */
+struct shm_hdr {
+    char magic[8];
+    uint64_t version;
+    uint32_t cols, rows;
+    uint32_t start, len;
+    uint64_t size;              /* whole segment */
+    int32_t pid;                /* publisher */
+    _Atomic uint32_t ready;     /* the fields above are filled in */
+    _Atomic uint32_t frames;    /* frames published so far */
+};
+
+/* Frame-loop cache (--loop): once the bounce settles into its restart
+ * cycle, rotation is quantized to whole turns per cycle so every frame
+ * repeats exactly; each frame is then encoded once and replayed. */
+static struct {
+    int on;
+    int start, len;       /* first periodic frame and period; 0 = rebuild */
+    int frame;            /* frames since the cycle was found */
+    uint32_t base;        /* the animation's frame at sequence frame 0 */
+    float rot0[3], rate[3];
+    char *bytes;          /* frames 0 .. start+len-1, back to back */
+    size_t used, cap;
+    uint64_t *off;        /* frame i is bytes[off[i] .. off[i+1]) */
+    int stored;           /* frames encoded so far */
+    const char *dir;      /* --cache: where complete loops are saved */
+    int shm;              /* --shm: share loops between running instances */
+    int unfilled;         /* --cache or --shm: the loop is yet to be filled */
+    double sized_at;      /* when the terminal last changed size */
+    struct shm_hdr *shared; /* header of the attached segment, if any */
+    void *map;            /* cache file or segment: bytes, off point in */
+    size_t map_size;
+} loop;
 
 static void cleanup_terminal(void) {
-    static const char seq[] = "\033[0m\033[?25h\033[?1049l";
+    static const char seq[] = "\033[0m\033[?1004l\033[?25h\033[?1049l";
     write(STDOUT_FILENO, seq, sizeof(seq) - 1);
     tcsetattr(STDIN_FILENO, TCSANOW, &orig_tios);
 }
 
+/* Also run on coming back to the foreground, when the shell may have
+ * changed the modes meanwhile; the ones to restore are from the start */
+static void setup_terminal(void) {
+    /* Raw mode so any keypress (including ctrl-c) is readable as input */
+    static int saved;
+    if (!saved) tcgetattr(STDIN_FILENO, &orig_tios);
+    saved = 1;
+    struct termios raw = orig_tios;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    static const char seq[] = "\033[?1049h\033[?25l";
+    write(STDOUT_FILENO, seq, sizeof(seq) - 1);
+    if (flow.on) {
+        static const char focus[] = "\033[?1004h";
+        write(STDOUT_FILENO, focus, sizeof(focus) - 1);
+    }
+}
+
+/* Background jobs. A job put in the background keeps the terminal open
+ * but must leave it alone: its output would land over the shell's, and
+ * with stty tostop it is stopped by SIGTTOU partway through a frame. The
+ * job's state is checked before every frame, and SIGTTOU and SIGTTIN are
+ * caught so a write or read that raced it fails instead of stopping. A
+ * background job sleeps until it is brought back (SIGCONT cuts a wait
+ * short, but fg doesn't send it to a job that is running), then takes
+ * the terminal again and repaints. */
+static int foreground(void) {
+    pid_t pg = tcgetpgrp(STDOUT_FILENO);
+    return pg < 0 || pg == getpgrp();
+}
+
+static void on_tty_signal(int sig) { (void)sig; }
+
+/* Returns 0 if a signal asked to stop meanwhile */
+static int wait_foreground(void) {
+    while (!foreground()) {
+        if (stop) return 0;
+        poll(NULL, 0, 1000);
+    }
+    return !stop;
+}
+
 static void on_signal(int sig) {
-    cleanup_terminal();
+    /* A recording or headless run is wound up by the frame loop instead,
+     * so the file is complete, and so is one probing the terminal, so the
+     * answers still on their way are drained rather than left for the
+     * shell. A second signal doesn't wait: the terminal is restored and
+     * the signal kills. */
+    if ((rec.f || headless || flow.on) && !stop) {
+        stop = sig;
+        return;
+    }
+    if (!headless) cleanup_terminal();
     signal(sig, SIG_DFL);
     raise(sig);
 }
 
-static void fb_clear(void) { memset(fb, 0, (size_t)cw * ch); }
+static void on_winch(int sig) { (void)sig; winch = 1; }
 
-static void fb_set(int x, int y) {
-    if (x < 0 || x >= pw || y < 0 || y >= ph) return;
-    static const unsigned char bits[2][4] = {
-        {0x01, 0x02, 0x04, 0x40},
-        {0x08, 0x10, 0x20, 0x80}
-    };
-    fb[(y / 4) * cw + (x / 2)] |= bits[x & 1][y & 3];
+#define SYNC_BEGIN "\033[?2026h" /* opens the clear that starts a repaint */
+#define OUT_CHUNK 65536 /* frames are streamed out this much at a time */
+
+/* Size of the encode buffer: the whole frame when it fits in a chunk,
+ * otherwise a chunk that always has room for at least one more row. */
+static size_t out_bound(int cols, int rows) {
+    size_t frame = icosa_frame_bound(cols, rows), row = icosa_chunk_min(cols);
+    size_t chunk = row > OUT_CHUNK ? row : OUT_CHUNK;
+    return frame < chunk ? frame : chunk;
+}
+
+static char *obuf;
+static size_t obuf_cap;
+
+static void write_all(const char *p, size_t n) {
+    if (hidden) return;
+    double t0 = stats.on ? mono_now() : 0;
+    if (stats.on) stats.bytes += n;
+    out_bytes += n;
+    while (n > 0) {
+        ssize_t w = write(STDOUT_FILENO, p, n);
+        if (w < 0) {
+            /* The rest of the frame is abandoned once in the background */
+            if ((errno == EINTR || errno == EIO) && !foreground()) hidden = 1;
+            else if (errno == EINTR && !stop) continue;
+            else if (errno != EAGAIN && errno != EINTR) out_gone = 1;
+            return;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    if (stats.on) stats.frame_stall += mono_now() - t0;
+}
+
+/* A probe goes out like frame bytes, so it is counted against --max-bps
+ * and in --stats, and held back in the background; it isn't recorded */
+static void flow_probe(void) {
+    static const char dsr[] = "\033[6n";
+    if (!flow.on || hidden || flow.inflight == MAX_IN_FLIGHT ||
+        (!flow.answered && flow.inflight))
+        return;
+    write_all(dsr, sizeof(dsr) - 1);
+    flow.sent[(flow.head + flow.inflight++) % MAX_IN_FLIGHT] = mono_now();
+}
+
+/* Close a frame's accounting */
+static void stats_frame_end(int drawn) {
+    if (!stats.on) return;
+    stats.frames += drawn;
+    stats.stall += stats.frame_stall;
+    if (stats.frame_stall > stats.stall_max) stats.stall_max = stats.frame_stall;
+    stats.frame_stall = 0;
+}
+
+static void stats_report(double secs) {
+    if (!stats.on) return;
+    fprintf(stderr, "{\"frames\":%ld,\"seconds\":%.3f,\"fps\":%.2f,\"bytes\":%llu,"
+            "\"stall_ms\":%.1f,\"stall_max_ms\":%.1f,\"dropped\":%ld,"
+            "\"rtt_ms\":%.1f,\"rtt_max_ms\":%.1f,\"cpu_ms\":%.1f,\"level\":%d,"
+            "\"bps_level\":%d}\n",
+            stats.frames, secs, secs > 0 ? stats.frames / secs : 0.0,
+            (unsigned long long)stats.bytes, stats.stall * 1e3, stats.stall_max * 1e3,
+            stats.dropped, flow.rtt * 1e3, flow.rtt_max * 1e3, cpu_now() * 1e3, gov.level,
+            bps.level);
+}
+
+static int rec_open(const char *path, int cols, int rows) {
+    rec.f = fopen(path, "w");
+    if (!rec.f) return -1;
+    setvbuf(rec.f, NULL, _IOFBF, 1 << 18);
+    fprintf(rec.f, "{\"version\": 2, \"width\": %d, \"height\": %d", cols, rows);
+    /* Headless captures leave out the wall clock so they are reproducible */
+    const char *term = getenv("TERM");
+    if (!headless) {
+        fprintf(rec.f, ", \"timestamp\": %lld", (long long)time(NULL));
+        if (term && strlen(term) < 64 && !strpbrk(term, "\"\\"))
+            fprintf(rec.f, ", \"env\": {\"TERM\": \"%s\"}", term);
+    }
+    fputs("}\n", rec.f);
+    return 0;
+}
+
+static void rec_data(const char *p, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    char buf[4096], *q = buf;
+    if (!rec.open) {
+        fprintf(rec.f, "[%.6f, \"o\", \"", rec.t);
+        rec.open = 1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (q > buf + sizeof(buf) - 6) {
+            fwrite(buf, 1, (size_t)(q - buf), rec.f);
+            q = buf;
+        }
+        unsigned char c = (unsigned char)p[i];
+        if (c == '"' || c == '\\') {
+            *q++ = '\\';
+            *q++ = (char)c;
+        } else if (c < 0x20 || c == 0x7f) {
+            q = memcpy(q, "\\u00", 4) + 4;
+            *q++ = hex[c >> 4];
+            *q++ = hex[c & 15];
+        } else {
+            *q++ = (char)c;
+        }
+    }
+    fwrite(buf, 1, (size_t)(q - buf), rec.f);
+}
+
+/* Close the current frame's event, if anything was output */
+static void rec_frame_end(void) {
+    if (!rec.f || !rec.open) return;
+    fputs("\"]\n", rec.f);
+    rec.open = 0;
+}
+
+static void rec_resize(int cols, int rows) {
+    if (rec.f) fprintf(rec.f, "[%.6f, \"r\", \"%dx%d\"]\n", rec.t, cols, rows);
+}
+
+/* Bytes bound for the terminal: recorded, and written unless a headless
+ * run is recording (then the file is the only output) */
+static void output(const char *p, size_t n) {
+    if (rec.f) rec_data(p, n);
+    if (!headless || !rec.f) write_all(p, n);
+}
+
+/* Where render() sends encoded bytes; the loop cache taps in here */
+static void (*emit)(const char *p, size_t n) = output;
+
+/* Draw state s and stream it out through emit a chunk at a time */
+static void render(struct icosa *ctx, const struct icosa_state *s) {
+    int cols, rows;
+    icosa_get_size(ctx, &cols, &rows);
+    size_t need = out_bound(cols, rows);
+    if (need > obuf_cap) {
+        char *nb = realloc(obuf, need);
+        if (!nb) return;
+        obuf = nb;
+        obuf_cap = need;
+    }
+    *icosa_state(ctx) = *s;
+    icosa_rasterize(ctx);
+    /* Under a cap, a frame that changed more than a whole one costs goes
+     * out whole. Only a diff the bucket can't cover is worth comparing. */
+    if (bps.rate && (icosa_get_flags(ctx) & ICOSA_DIFF)) {
+        size_t diff = icosa_measure(ctx, 0);
+        if ((double)diff > bps.tokens && icosa_measure(ctx, 1) < diff) icosa_invalidate(ctx);
+    }
+    size_t n;
+    while ((n = icosa_encode(ctx, obuf, obuf_cap)) > 0)
+        emit(obuf, n);
+}
+
+/* The terminal's context at the current size. A loop streamed from the
+ * cache never needs one, so it is only made once something is drawn. */
+static struct icosa *term_view(void) {
+    if (!tv) {
+        struct icosa_opts o = { view_flags(), merge };
+        return tv = icosa_create(tcols, trows, &o);
+    }
+    return icosa_resize(tv, tcols, trows) < 0 ? NULL : tv;
+}
+
+#define LOOP_MAX 4096 /* sanity bound on a cached loop */
+
+static void loop_unmap(void) {
+    if (!loop.map) return;
+    munmap(loop.map, loop.map_size);
+    loop.map = NULL;
+    loop.shared = NULL;
+    loop.bytes = NULL;
+    loop.off = NULL;
+    loop.cap = 0;
+}
+
+/* Set up the loop from the current frame, using the bounce cycle the
+ * library works out exactly from the physics */
+static int loop_build(void) {
+    loop_unmap();
+    uint32_t start, len;
+    icosa_cycle(&start, &len);
+    if (len == 0 || len >= LOOP_MAX || start >= LOOP_MAX) return -1;
+    loop.len = (int)len;
+    loop.start = anim.frame < start ? (int)(start - anim.frame) : 0;
+    loop.base = anim.frame;
+
+    size_t n = (size_t)loop.start + loop.len + 1;
+    uint64_t *off = realloc(loop.off, n * sizeof(*off));
+    if (!off) return -1;
+    loop.off = off;
+    loop.off[0] = 0;
+    loop.used = 0;
+    loop.stored = 0;
+    loop.frame = 0;
+
+    /* Round each axis to a whole number of turns per cycle */
+    const float two_pi = 6.28318531f;
+    float spin[3];
+    icosa_spin(spin);
+    for (int i = 0; i < 3; i++) {
+        float turns = fmaxf(1.0f, roundf(spin[i] * (float)loop.len / two_pi));
+        loop.rate[i] = turns * two_pi / (float)loop.len;
+        loop.rot0[i] = anim.rot[i];
+    }
+    return 0;
+}
+
+/* On-disk loop cache (--cache). A file holds the complete cold-start
+ * sequence for one terminal size: the frames before the cycle, then one
+ * period. The name carries the size and a hash of everything that shapes
+ * the bytes, so stale files are simply never opened. */
+#define CACHE_FORMAT 4 /* bump whenever the file or the sequence changes */
+
+struct cache_hdr {
+    char magic[8];
+    uint64_t version;
+    uint32_t cols, rows;
+    uint32_t start, len;
+};
+
+static uint64_t fnv1a(uint64_t h, const void *p, size_t n) {
+    const unsigned char *s = p;
+    while (n--) h = (h ^ *s++) * 0x100000001b3ULL;
+    return h;
+}
+
+static uint64_t cache_version(void) {
+    static const int format = CACHE_FORMAT;
+    uint64_t lib = icosa_version();
+    uint64_t h = fnv1a(0xcbf29ce484222325ULL, &format, sizeof(format));
+    h = fnv1a(h, &look, sizeof(look));
+    h = fnv1a(h, &merge, sizeof(merge));
+    return fnv1a(h, &lib, sizeof(lib));
+}
+
+static int cache_path(char *buf, size_t n, int cols, int rows) {
+    int r = snprintf(buf, n, "%s/%dx%d-%016llx.frames", loop.dir, cols, rows,
+                     (unsigned long long)cache_version());
+    return r < 0 || (size_t)r >= n ? -1 : 0;
+}
+
+/* Map the cached loop for this size, if there is a valid one */
+static int cache_load(int cols, int rows) {
+    char path[4096];
+    if (cache_path(path, sizeof(path), cols, rows) < 0) return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(struct cache_hdr))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    size_t size = (size_t)st.st_size;
+    const struct cache_hdr *h = map;
+    size_t n = (size_t)h->start + h->len;
+    size_t table = sizeof(*h) + (n + 1) * sizeof(uint64_t);
+    const uint64_t *off = (const uint64_t *)(h + 1);
+    int ok = memcmp(h->magic, "ICOSAFRM", 8) == 0 &&
+             h->version == cache_version() && h->cols == (uint32_t)cols &&
+             h->rows == (uint32_t)rows && h->len > 0 &&
+             h->start < LOOP_MAX && h->len < LOOP_MAX && table <= size;
+    for (size_t i = 0; ok && i < n; i++)
+        ok = off[i] <= off[i + 1];
+    if (!ok || off[0] != 0 || off[n] > size - table) {
+        munmap(map, size);
+        return -1;
+    }
+
+    free(loop.bytes);
+    free(loop.off);
+    loop.map = map;
+    loop.map_size = size;
+    loop.off = (uint64_t *)off;
+    loop.bytes = (char *)map + table;
+    loop.start = (int)h->start;
+    loop.len = (int)h->len;
+    loop.stored = (int)n;
+    loop.frame = 0;
+    return 0;
+}
+
+static int mkdirs(const char *dir) {
+    char buf[4096];
+    size_t n = strlen(dir);
+    if (n >= sizeof(buf)) return -1;
+    memcpy(buf, dir, n + 1);
+    for (char *p = buf + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = 0;
+        if (mkdir(buf, 0755) < 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return mkdir(buf, 0755) < 0 && errno != EEXIST ? -1 : 0;
+}
+
+/* Save the finished loop. Written to a private temporary and renamed into
+ * place, so concurrent instances only ever see complete files. */
+static void cache_save(void) {
+    char path[4096], tmp[4200];
+    if (cache_path(path, sizeof(path), tcols, trows) < 0 || mkdirs(loop.dir) < 0)
+        return;
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    FILE *f = fopen(tmp, "wbx");
+    if (!f) return;
+
+    struct cache_hdr h = { .magic = "ICOSAFRM", .version = cache_version(),
+                           .cols = (uint32_t)tcols, .rows = (uint32_t)trows,
+                           .start = (uint32_t)loop.start,
+                           .len = (uint32_t)loop.len };
+    size_t n = (size_t)loop.stored + 1;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(loop.off, sizeof(*loop.off), n, f) == n &&
+             fwrite(loop.bytes, 1, loop.used, f) == loop.used;
+    if (fclose(f) == 0 && ok && rename(tmp, path) == 0) return;
+    unlink(tmp);
+}
+
+static void loop_store(const char *p, size_t n) {
+    if (loop.used + n > loop.cap && loop.map) {
+        loop.on = 0; /* can't happen: segments are sized by icosa_frame_bound() */
+        return;
+    }
+    if (loop.used + n > loop.cap) {
+        size_t cap = loop.cap ? loop.cap : 65536;
+        while (cap < loop.used + n) cap *= 2;
+        char *nb = realloc(loop.bytes, cap);
+        if (!nb) {
+            loop.on = 0;
+            return;
+        }
+        loop.bytes = nb;
+        loop.cap = cap;
+    }
+    memcpy(loop.bytes + loop.used, p, n);
+    loop.used += n;
+}
+
+static void loop_capture(const char *p, size_t n) {
+    if (loop.on) loop_store(p, n);
+    output(p, n);
+}
+
+/* Draw frame i of the sequence. Its bounce comes from its index, not
+ * from anim, which isn't stepped while a mapped loop is being played. */
+static void loop_draw(int i, void (*out)(const char *, size_t)) {
+    struct icosa *ctx = term_view();
+    if (!ctx) {
+        loop.on = 0;
+        return;
+    }
+    struct icosa_state s;
+    icosa_state_at(&s, loop.base + (uint32_t)i);
+    for (int a = 0; a < 3; a++)
+        s.rot[a] = loop.rot0[a] + loop.rate[a] * (float)i;
+    emit = out;
+    render(ctx, &s);
+    emit = output;
+}
+
+/* Encode the rest of the sequence without writing it, for --cache and
+ * for --shm publishers. A miss costs one burst of rendering instead of
+ * waiting a full pass of the animation, which a greeting never sees.
+ * Shared frames are published one by one as they're finished. */
+static void loop_fill(void) {
+    for (int i = loop.stored; loop.on && i < loop.start + loop.len; i++) {
+        loop_draw(i, loop_store);
+        if (!loop.on) break;
+        loop.off[++loop.stored] = loop.used;
+        if (loop.shared)
+            atomic_store_explicit(&loop.shared->frames, (uint32_t)loop.stored,
+                                  memory_order_release);
+    }
+    if (loop.on && loop.dir) cache_save();
+}
+
+static int shm_path(char *buf, size_t n, int cols, int rows) {
+    int r = snprintf(buf, n, "/icosa-%u-%dx%d-%016llx", (unsigned)getuid(),
+                     cols, rows, (unsigned long long)cache_version());
+    return r < 0 || (size_t)r >= n ? -1 : 0;
+}
+
+static void shm_use(void *map, size_t size) {
+    struct shm_hdr *h = map;
+    loop.map = map;
+    loop.map_size = size;
+    loop.shared = h;
+    loop.off = (uint64_t *)(h + 1);
+    loop.bytes = (char *)map + sizeof(*h) +
+                 ((size_t)loop.start + loop.len + 1) * sizeof(uint64_t);
+}
+
+static int shm_publish(const char *name) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return -1;
+    size_t n = (size_t)loop.start + loop.len;
+    size_t cap = n * icosa_frame_bound(tcols, trows);
+    size_t size = sizeof(struct shm_hdr) + (n + 1) * sizeof(uint64_t) + cap;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name);
+        return -1;
+    }
+
+    free(loop.bytes);
+    free(loop.off);
+    struct shm_hdr *h = map;
+    memcpy(h->magic, "ICOSASHM", 8);
+    h->version = cache_version();
+    h->cols = (uint32_t)tcols;
+    h->rows = (uint32_t)trows;
+    h->start = (uint32_t)loop.start;
+    h->len = (uint32_t)loop.len;
+    h->size = size;
+    h->pid = (int32_t)getpid();
+    shm_use(map, size);
+    loop.off[0] = 0;
+    loop.cap = cap;
+    atomic_store_explicit(&h->ready, 1, memory_order_release);
+    return 0;
+}
+
+static int shm_follow(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) < 0 || st.st_uid != getuid()) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size >= sizeof(struct shm_hdr))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    struct shm_hdr *h = map;
+    int ready = map != MAP_FAILED &&
+                atomic_load_explicit(&h->ready, memory_order_acquire);
+    if (!ready && time(NULL) - st.st_mtime > 5)
+        shm_unlink(name); /* publisher died before getting going */
+    if (map == MAP_FAILED) return -1;
+
+    int ok = ready && memcmp(h->magic, "ICOSASHM", 8) == 0 &&
+             h->version == cache_version() && h->cols == (uint32_t)tcols &&
+             h->rows == (uint32_t)trows && h->start == (uint32_t)loop.start &&
+             h->len == (uint32_t)loop.len && h->size == (uint64_t)st.st_size;
+    if (!ok) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    free(loop.bytes);
+    free(loop.off);
+    shm_use(map, (size_t)st.st_size);
+    loop.cap = 0;
+    return 0;
+}
+
+/* Attach to the segment for the current loop. Returns 1 if we are the
+ * publisher and must fill it, 0 if following another instance, and -1
+ * if this loop isn't shared. A segment whose publisher died before
+ * finishing is removed, so that the next instance starts it afresh. */
+static int shm_attach(void) {
+    char name[256];
+    if (shm_path(name, sizeof(name), tcols, trows) < 0) return -1;
+    if (shm_publish(name) == 0) {
+        loop.stored = 0; /* frames recorded so far were left behind */
+        loop.used = 0;
+        return 1;
+    }
+    if (errno != EEXIST || shm_follow(name) < 0) return -1;
+
+    uint32_t done = atomic_load_explicit(&loop.shared->frames, memory_order_acquire);
+    if (done < (uint32_t)(loop.start + loop.len) &&
+        kill(loop.shared->pid, 0) < 0 && errno == ESRCH)
+        shm_unlink(name);
+    return 0;
+}
+
+/* Produce one frame in --loop mode: replay it if this point of the
+ * sequence has been encoded before, otherwise draw and record it.
+ * Returns -1, leaving the frame to the caller, if there is no cycle.
+ * With --cache or --shm the rest of the loop is filled and shared once
+ * the size has held for LOOP_SETTLE; until then frames are recorded as
+ * they're shown, so a drag-resize neither stalls on a fill nor leaves
+ * a loop behind for every size it passes through. */
+#define LOOP_SETTLE 0.5 /* seconds */
+
+static int loop_frame(int drop) {
+    if (!loop.len) {
+        if (loop_build() < 0) {
+            loop.on = 0; /* no cycle within reach: plain rendering */
+            return -1;
+        }
+        loop.unfilled = loop.dir || loop.shm;
+    }
+    if (loop.unfilled && mono_now() - loop.sized_at >= LOOP_SETTLE) {
+        loop.unfilled = 0;
+        int shared = loop.shm ? shm_attach() : -1;
+        if (shared == 1 || (shared < 0 && loop.dir)) loop_fill();
+        if (!loop.on) return -1;
+    }
+    int f = loop.frame++;
+    int i = f < loop.start ? f : loop.start + (f - loop.start) % loop.len;
+    int have = loop.shared ? (int)atomic_load_explicit(&loop.shared->frames,
+                                                       memory_order_acquire)
+                           : loop.stored;
+    if (i < have) {
+        if (!drop) output(loop.bytes + loop.off[i], loop.off[i + 1] - loop.off[i]);
+    } else if (loop.shared) {
+        if (!drop) loop_draw(i, output); /* not published yet: render it ourselves */
+    } else {
+        loop_draw(i, drop ? loop_store : loop_capture); /* the loop needs it anyway */
+        if (loop.on) loop.off[++loop.stored] = loop.used;
+    }
+    return 0;
+}
+
+/* Start the animation afresh at a size. With --cache, a saved loop for
+ * the size is streamed as-is and nothing is computed up front. With
+ * --cache or --shm a resize also restarts from cold, so that the frames
+ * recorded are the ones other runs and instances can use. */
+static int open_size(int cols, int rows) {
+    repaint = 1;
+    loop.len = 0; /* cached frames are for the old size */
+    if (tcols) loop.sized_at = mono_now(); /* a resize, not the first size */
+    tcols = cols;
+    trows = rows;
+    if (loop.dir || loop.shm) {
+        loop_unmap();
+        icosa_state_init(&anim);
+        if (loop.dir && cache_load(cols, rows) == 0) return 0;
+    }
+    return term_view() ? 0 : -1;
+}
+
+/* Broadcast daemon (--serve PATH). One simulation drives every client:
+ * each tick, each distinct client size is drawn and encoded once and the
+ * bytes are fanned out with non-blocking writes. A client still working
+ * through an earlier frame simply misses this one, so a slow link never
+ * holds up the rest. Clients are plain connected sockets, so anything
+ * that hands serve_add() a socketpair end can drive the daemon too. */
+
+/* Client → daemon messages are 5 bytes: a type, then two big-endian
+ * 16-bit values. 'S' cols rows reports the terminal size; 'Q' quits. */
+#define MSG_LEN 5
+#define SERVE_MAX_SIDE 4000          /* refuse absurd sizes from clients */
+#define SERVE_MAX_CELLS (1000L * 500)
+
+struct client {
+    int fd;
+    struct icosa *view;             /* NULL until a usable size arrives */
+    int repaint;                    /* next frame starts with a clear */
+    char *pend;                     /* unwritten tail of the last frame */
+    size_t pend_off, pend_len, pend_cap;
+    unsigned char msg[MSG_LEN];     /* partially read message */
+    int msg_len;
+};
+
+static struct {
+    int lfd;
+    struct client *cl;
+    int ncl, cap;
+    struct icosa **views;           /* one per distinct client size */
+    int nviews;
+    struct icosa_state state;       /* the one simulation */
+    char *frame;                    /* the frame being fanned out */
+    size_t len, frame_cap;
+    volatile sig_atomic_t quit;
+} srv = { .lfd = -1 };
+
+static struct icosa *serve_view(int cols, int rows) {
+    if (cols > SERVE_MAX_SIDE || rows > SERVE_MAX_SIDE ||
+        (long)cols * rows > SERVE_MAX_CELLS)
+        return NULL;
+    for (int i = 0; i < srv.nviews; i++) {
+        int c, r;
+        icosa_get_size(srv.views[i], &c, &r);
+        if (c == cols && r == rows) return srv.views[i];
+    }
+    struct icosa **nv = realloc(srv.views, (srv.nviews + 1) * sizeof(*nv));
+    if (!nv) return NULL;
+    srv.views = nv;
+    struct icosa_opts o = { look, merge };
+    struct icosa *v = icosa_create(cols, rows, &o);
+    if (v) srv.views[srv.nviews++] = v;
+    return v;
+}
+
+/* Drop a view once no client is using it */
+static void serve_release(struct icosa *v) {
+    if (!v) return;
+    for (int i = 0; i < srv.ncl; i++)
+        if (srv.cl[i].view == v) return;
+    for (int i = 0; i < srv.nviews; i++) {
+        if (srv.views[i] != v) continue;
+        srv.views[i] = srv.views[--srv.nviews];
+        icosa_destroy(v);
+        return;
+    }
 }
 
-static void draw_line(int x0, int y0, int x1, int y1) {
-    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
-    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
+static int serve_add(int fd) {
+    if (srv.ncl == srv.cap) {
+        int cap = srv.cap ? srv.cap * 2 : 16;
+        struct client *nc = realloc(srv.cl, (size_t)cap * sizeof(*nc));
+        if (!nc) return -1;
+        srv.cl = nc;
+        srv.cap = cap;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    srv.cl[srv.ncl++] = (struct client){ .fd = fd };
+    return 0;
+}
+
+static void serve_drop(int i) {
+    struct client c = srv.cl[i];
+    close(c.fd);
+    free(c.pend);
+    srv.cl[i] = srv.cl[--srv.ncl];
+    serve_release(c.view);
+}
+
+static int client_queue(struct client *c, const char *p, size_t n) {
+    if (c->pend_len + n > c->pend_cap) {
+        size_t cap = c->pend_cap ? c->pend_cap : 4096;
+        while (cap < c->pend_len + n) cap *= 2;
+        char *nb = realloc(c->pend, cap);
+        if (!nb) return -1;
+        c->pend = nb;
+        c->pend_cap = cap;
+    }
+    memcpy(c->pend + c->pend_len, p, n);
+    c->pend_len += n;
+    return 0;
+}
+
+/* Write what the socket will take without blocking; -1 on a dead client */
+static ssize_t client_write(struct client *c, const char *p, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t w = send(c->fd, p + done, n - done, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    return (ssize_t)done;
+}
+
+static int client_flush(struct client *c) {
+    if (c->pend_off == c->pend_len) return 0;
+    ssize_t w = client_write(c, c->pend + c->pend_off, c->pend_len - c->pend_off);
+    if (w < 0) return -1;
+    c->pend_off += (size_t)w;
+    if (c->pend_off == c->pend_len) c->pend_off = c->pend_len = 0;
+    return 0;
+}
+
+/* Hand a frame to a client, unless it's still busy with the last one */
+static int client_send(struct client *c, const char *p, size_t n) {
+    if (client_flush(c) < 0) return -1;
+    if (c->pend_len) return 0; /* backpressure: drop this frame */
+    if (c->repaint) {
+        static const char clear[] = SYNC_BEGIN "\033[2J";
+        if (client_queue(c, clear, sizeof(clear) - 1) < 0) return -1;
+        c->repaint = 0;
+        if (client_flush(c) < 0) return -1;
+        if (c->pend_len) return client_queue(c, p, n);
+    }
+    ssize_t w = client_write(c, p, n);
+    if (w < 0) return -1;
+    return (size_t)w < n ? client_queue(c, p + w, n - (size_t)w) : 0;
+}
+
+/* Read control messages; -1 when the client has gone or asked to quit */
+static int client_read(struct client *c) {
     for (;;) {
-        fb_set(x0, y0);
-        if (x0 == x1 && y0 == y1) break;
-        int e2 = 2 * err;
-        if (e2 >= dy) { err += dy; x0 += sx; }
-        if (e2 <= dx) { err += dx; y0 += sy; }
+        ssize_t r = read(c->fd, c->msg + c->msg_len, MSG_LEN - c->msg_len);
+        if (r == 0) return -1;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        c->msg_len += (int)r;
+        if (c->msg_len < MSG_LEN) continue;
+        c->msg_len = 0;
+
+        int a = c->msg[1] << 8 | c->msg[2], b = c->msg[3] << 8 | c->msg[4];
+        if (c->msg[0] == 'Q') return -1;
+        if (c->msg[0] != 'S') continue;
+        struct icosa *old = c->view;
+        c->view = serve_view(a, b);
+        c->repaint = 1;
+        if (old != c->view) serve_release(old);
+    }
+}
+
+/* One animation frame: draw and encode each size once, then fan out */
+static void serve_tick(void) {
+    icosa_tick(&srv.state);
+    /* Backwards, so a view freed with its last client is never revisited */
+    for (int i = srv.nviews - 1; i >= 0; i--) {
+        struct icosa *v = srv.views[i];
+        int cols, rows;
+        icosa_get_size(v, &cols, &rows);
+        size_t need = icosa_frame_bound(cols, rows);
+        if (need > srv.frame_cap) {
+            char *nb = realloc(srv.frame, need);
+            if (!nb) continue;
+            srv.frame = nb;
+            srv.frame_cap = need;
+        }
+        *icosa_state(v) = srv.state;
+        icosa_rasterize(v);
+        srv.len = icosa_encode(v, srv.frame, srv.frame_cap);
+        for (int j = 0; j < srv.ncl; j++) {
+            if (srv.cl[j].view != v) continue;
+            if (client_send(&srv.cl[j], srv.frame, srv.len) < 0)
+                serve_drop(j--);
+        }
+    }
+}
+
+static void on_serve_signal(int sig) { (void)sig; srv.quit = 1; }
+
+static int serve(const char *path) {
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "icosa: socket path too long\n");
+        return 1;
+    }
+    strcpy(sun.sun_path, path);
+    /* Replace a stale socket, but nothing else that's in the way */
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "icosa: %s: exists and is not a socket\n", path);
+            return 1;
+        }
+        unlink(path);
+    }
+    srv.lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (srv.lfd < 0 || bind(srv.lfd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+        listen(srv.lfd, 64) < 0) {
+        fprintf(stderr, "icosa: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fcntl(srv.lfd, F_SETFL, fcntl(srv.lfd, F_GETFL) | O_NONBLOCK);
+    icosa_state_init(&srv.state);
+
+    struct sigaction sa = {0};
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = on_serve_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct pollfd *pfd = NULL;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!srv.quit) {
+        struct pollfd *np = realloc(pfd, (size_t)(srv.ncl + 1) * sizeof(*np));
+        if (!np) break;
+        pfd = np;
+        pfd[0] = (struct pollfd){ .fd = srv.lfd, .events = POLLIN };
+        for (int i = 0; i < srv.ncl; i++)
+            pfd[i + 1] = (struct pollfd){
+                .fd = srv.cl[i].fd,
+                .events = POLLIN | (srv.cl[i].pend_len ? POLLOUT : 0) };
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (next.tv_sec - now.tv_sec) * 1000L +
+                  (next.tv_nsec - now.tv_nsec) / 1000000L;
+        int n = srv.ncl;
+        if (poll(pfd, (nfds_t)n + 1, ms > 0 ? (int)ms : 0) < 0 && errno != EINTR)
+            break;
+
+        /* Walk backwards so dropping a client doesn't skip another */
+        for (int i = n - 1; i >= 0; i--) {
+            short re = pfd[i + 1].revents;
+            if (!re) continue;
+            if (((re & (POLLIN | POLLHUP | POLLERR)) && client_read(&srv.cl[i]) < 0) ||
+                ((re & POLLOUT) && client_flush(&srv.cl[i]) < 0))
+                serve_drop(i);
+        }
+        if (pfd[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(srv.lfd, NULL, NULL)) >= 0)
+                if (serve_add(fd) < 0) close(fd);
+        }
+
+        if (ms <= 0) {
+            serve_tick();
+            next.tv_nsec += 33000000L;
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            if (ms < -100) next = now; /* fell far behind: don't catch up */
+        }
     }
+
+    free(pfd);
+    while (srv.ncl) serve_drop(srv.ncl - 1);
+    close(srv.lfd);
+    unlink(path);
+    free(srv.frame);
+    free(srv.views);
+    free(srv.cl);
+    return 0;
 }
 
-static void compute_floor(void) {
-    floor_map = calloc((size_t)cw * ch, 1);
-    horizon = ch * 55 / 100;
+static int send_msg(int fd, char type, int a, int b) {
+    unsigned char m[MSG_LEN] = { (unsigned char)type, (unsigned char)(a >> 8),
+                                 (unsigned char)a, (unsigned char)(b >> 8),
+                                 (unsigned char)b };
+    return send(fd, m, MSG_LEN, MSG_NOSIGNAL) == MSG_LEN ? 0 : -1;
+}
+
+/* Thin client (--connect PATH): relay the daemon's bytes to the terminal
+ * and report size changes and the quit key back to it. */
+static int connect_client(const char *path) {
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "icosa: socket path too long\n");
+        return 1;
+    }
+    strcpy(sun.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+        fprintf(stderr, "icosa: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_col < ICOSA_MIN_COLS ||
+        ws.ws_row < ICOSA_MIN_ROWS)
+        return 1;
+    setup_terminal();
+    send_msg(fd, 'S', ws.ws_col, ws.ws_row);
+
+    struct pollfd pfd[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = fd, .events = POLLIN },
+    };
+    char buf[65536];
+    for (;;) {
+        if (winch) {
+            winch = 0;
+            if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0)
+                send_msg(fd, 'S', ws.ws_col, ws.ws_row);
+        }
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfd[0].revents & POLLIN) {
+            send_msg(fd, 'Q', 0, 0);
+            break;
+        }
+        if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            write_all(buf, (size_t)r);
+        }
+    }
+    close(fd);
+    cleanup_terminal();
+    return 0;
+}
 
-    float floor_h = (float)(ch - horizon);
-    for (int row = horizon + 1; row < ch; row++) {
-        float t = (float)(row - horizon) / floor_h; /* 0→1 from horizon→bottom */
-        float z = 1.0f / t;                         /* perspective depth */
-        for (int col = 0; col < cw; col++) {
-            float x = ((float)col / (float)cw - 0.5f) * z * 8.0f;
-            int ix = (int)floorf(x);
-            int iz = (int)floorf(z * 4.0f);
-            floor_map[row * cw + col] = (unsigned char)(((ix + iz) & 1) ? 1 : 2);
+/* Sleep until the next frame deadline, returning 1 on a keypress.
+ * Probe answers arriving meanwhile are taken in without waking up.
+ * Polling against a deadline rather than for a fixed 33ms means a burst
+ * of SIGWINCHs interrupting the wait can't speed the animation up. Out of
+ * focus, it sleeps until input comes instead, and the animation pauses. */
+static int wait_frame(struct timespec *next, struct pollfd *pfd) {
+    next->tv_nsec += 33000000L;
+    if (next->tv_nsec >= 1000000000L) {
+        next->tv_nsec -= 1000000000L;
+        next->tv_sec++;
+    }
+    for (;;) {
+        if (stop || lone_escape()) return 1;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (next->tv_sec - now.tv_sec) * 1000L +
+                  (next->tv_nsec - now.tv_nsec) / 1000000L;
+        if (ms <= 0 && !unfocused) {
+            if (ms < -100) *next = now; /* fell far behind: don't catch up */
+            return 0;
         }
+        int wait = unfocused ? -1 : ms > 0 ? (int)ms : 0;
+        if (flow.esc == 1) { /* wake to see whether the ESC stays alone */
+            int esc_ms = (int)((flow.esc_at + ESC_WAIT - mono_now()) * 1000) + 1;
+            if (wait < 0 || esc_ms < wait) wait = esc_ms > 0 ? esc_ms : 0;
+        }
+        if (poll(pfd, 1, wait) > 0 && input_ready(pfd))
+            return 1;
     }
 }
 
-static char *put_str(char *p, const char *s) {
-    while (*s) *p++ = *s++;
-    return p;
+static const char *default_cache_dir(void) {
+    static char buf[4096];
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    int r;
+    if (xdg && *xdg)
+        r = snprintf(buf, sizeof(buf), "%s/icosa", xdg);
+    else if (home && *home)
+        r = snprintf(buf, sizeof(buf), "%s/.cache/icosa", home);
+    else
+        return NULL;
+    return r < 0 || (size_t)r >= sizeof(buf) ? NULL : buf;
+}
+
+/* GIF export (--gif FILE). Cells become 8x16-pixel blocks with each
+ * braille dot a 3x3 square, or each block glyph's part of the cell
+ * filled, in a fixed palette matching the terminal's
+ * colors. Every frame after the first covers only the rectangle that
+ * changed, with the pixels in it that didn't change left transparent, and
+ * is written out as soon as it is encoded; nothing is kept but the
+ * previous image. */
+#define GIF_CW 8
+#define GIF_CH 16
+#define GIF_DOT 3
+#define GIF_DEPTH 3 /* bits per pixel: an 8-entry palette */
+
+enum { GIF_SKY, GIF_DARK, GIF_LIGHT, GIF_OBJECT, GIF_CLEAR };
+
+static const unsigned char gif_palette[1 << GIF_DEPTH][3] = {
+    {0x00, 0x00, 0x00}, /* sky: the default background */
+    {0x30, 0x30, 0x30}, /* color 236 */
+    {0xd0, 0xd0, 0xd0}, /* color 252 */
+    {0x00, 0xff, 0xff}, /* bright cyan (96) */
+};
+
+static void put_le16(FILE *f, int v) {
+    putc(v & 0xff, f);
+    putc(v >> 8 & 0xff, f);
+}
+
+/* LZW in GIF's flavor: codes from GIF_DEPTH+1 up to 12 bits, packed LSB
+ * first into sub-blocks of up to 255 bytes. The string table is a hash
+ * of (prefix code, next pixel) pairs. */
+#define LZW_MAX 4096
+#define LZW_HASH 8191 /* prime, about twice LZW_MAX */
+
+struct lzw {
+    FILE *f;
+    uint32_t acc;          /* bits not yet written */
+    int nacc;
+    unsigned char blk[255];
+    int nblk;
+    int size, next;        /* current code width, next free code */
+    int32_t key[LZW_HASH]; /* prefix << 8 | pixel, or -1 */
+    int16_t code[LZW_HASH];
+};
+
+static void lzw_byte(struct lzw *z, int b) {
+    z->blk[z->nblk++] = (unsigned char)b;
+    if (z->nblk < 255) return;
+    putc(255, z->f);
+    fwrite(z->blk, 1, 255, z->f);
+    z->nblk = 0;
+}
+
+static void lzw_put(struct lzw *z, int code) {
+    z->acc |= (uint32_t)code << z->nacc;
+    z->nacc += z->size;
+    for (; z->nacc >= 8; z->nacc -= 8, z->acc >>= 8) lzw_byte(z, (int)(z->acc & 0xff));
 }
 
-static void render(void) {
-    char *p = rbuf;
-    p = put_str(p, "\033[H");
+static void lzw_reset(struct lzw *z) {
+    memset(z->key, 0xff, sizeof(z->key));
+    z->size = GIF_DEPTH + 1;
+    z->next = (1 << GIF_DEPTH) + 2;
+}
 
-    int prev = -1;
-    for (int y = 0; y < ch; y++) {
-        for (int x = 0; x < cw; x++) {
-            int idx = y * cw + x;
-            int mode = fb[idx] ? 3 : floor_map[idx];
+static void lzw_encode(struct lzw *z, const unsigned char *pix, size_t n) {
+    const int clear = 1 << GIF_DEPTH;
+    putc(GIF_DEPTH, z->f);
+    z->acc = 0;
+    z->nacc = 0;
+    z->nblk = 0;
+    lzw_reset(z);
+    lzw_put(z, clear);
 
-            if (mode != prev) {
-                switch (mode) {
-                case 0: p = put_str(p, "\033[0m"); break;
-                case 1: p = put_str(p, "\033[48;5;236m"); break;
-                case 2: p = put_str(p, "\033[48;5;252m"); break;
-                case 3: p = put_str(p, "\033[0;96m"); break;
+    int prefix = pix[0];
+    for (size_t i = 1; i < n; i++) {
+        int32_t key = prefix << 8 | pix[i];
+        size_t h = (size_t)key % LZW_HASH;
+        while (z->key[h] >= 0 && z->key[h] != key) h = h ? h - 1 : LZW_HASH - 1;
+        if (z->key[h] == key) {
+            prefix = z->code[h];
+            continue;
+        }
+        lzw_put(z, prefix);
+        if (z->next < LZW_MAX) {
+            /* Widen when the next code would not fit, as decoders do */
+            if (z->next == 1 << z->size) z->size++;
+            z->key[h] = key;
+            z->code[h] = (int16_t)z->next++;
+        } else {
+            lzw_put(z, clear);
+            lzw_reset(z);
+        }
+        prefix = pix[i];
+    }
+    lzw_put(z, prefix);
+    lzw_put(z, clear + 1);
+    if (z->nacc) lzw_byte(z, (int)(z->acc & 0xff));
+    if (z->nblk) {
+        putc(z->nblk, z->f);
+        fwrite(z->blk, 1, (size_t)z->nblk, z->f);
+    }
+    putc(0, z->f);
+}
+
+/* Paint the rasterized cells into an indexed image */
+static void gif_paint(struct icosa *ctx, unsigned char *img, int cols, int rows) {
+    int dw, dh, braille = icosa_glyphs() == ICOSA_GLYPHS_BRAILLE;
+    icosa_cell_dots(&dw, &dh);
+    const unsigned char *dots, *floor;
+    icosa_cells(ctx, &dots, &floor);
+    size_t w = (size_t)cols * GIF_CW;
+    for (int cy = 0; cy < rows; cy++) {
+        for (int cx = 0; cx < cols; cx++) {
+            unsigned char d = dots[cy * cols + cx];
+            unsigned char *cell = img + (size_t)cy * GIF_CH * w + (size_t)cx * GIF_CW;
+            /* Object cells reset the background, as in the terminal */
+            int bg = d ? GIF_SKY : floor[cy * cols + cx];
+            for (int y = 0; y < GIF_CH; y++) memset(cell + y * w, bg, GIF_CW);
+            for (int dx = 0; d && dx < dw; dx++)
+                for (int dy = 0; dy < dh; dy++) {
+                    if (!(d & icosa_dot_bit(dx, dy))) continue;
+                    int x0 = dx * GIF_CW / dw, y0 = dy * GIF_CH / dh;
+                    int x1 = braille ? x0 + GIF_DOT : (dx + 1) * GIF_CW / dw;
+                    int y1 = braille ? y0 + GIF_DOT : (dy + 1) * GIF_CH / dh;
+                    for (int y = y0; y < y1; y++) memset(cell + y * w + x0, GIF_OBJECT, x1 - x0);
                 }
-                prev = mode;
-            }
+        }
+    }
+}
 
-            if (fb[idx]) {
-                unsigned int cp = 0x2800 + fb[idx];
-                *p++ = (char)(0xE0 | (cp >> 12));
-                *p++ = (char)(0x80 | ((cp >> 6) & 0x3F));
-                *p++ = (char)(0x80 | (cp & 0x3F));
-            } else {
-                *p++ = ' ';
-            }
+/* Write one frame: the whole image when prev is NULL, otherwise the
+ * bounding box of what changed since prev. delay is in 1/100 s. */
+static void gif_frame(struct lzw *z, const unsigned char *img, const unsigned char *prev,
+                      unsigned char *sub, int w, int h, int delay) {
+    int x0 = 0, y0 = 0, x1 = w, y1 = h;
+    if (prev) {
+        x0 = w, y0 = h, x1 = 0, y1 = 0;
+        for (int y = 0; y < h; y++) {
+            const unsigned char *a = img + (size_t)y * w, *b = prev + (size_t)y * w;
+            if (memcmp(a, b, (size_t)w) == 0) continue;
+            int l = 0, r = w;
+            while (a[l] == b[l]) l++;
+            while (a[r - 1] == b[r - 1]) r--;
+            if (l < x0) x0 = l;
+            if (r > x1) x1 = r;
+            if (y < y0) y0 = y;
+            y1 = y + 1;
         }
-        p = put_str(p, "\033[0m");
-        prev = -1;
-        if (y < ch - 1) *p++ = '\n';
+        if (x0 >= x1) x0 = y0 = 0, x1 = y1 = 1; /* nothing moved: hold the frame */
     }
 
-    fwrite(rbuf, 1, (size_t)(p - rbuf), stdout);
-    fflush(stdout);
+    size_t n = 0;
+    for (int y = y0; y < y1; y++)
+        for (int x = x0; x < x1; x++) {
+            size_t i = (size_t)y * w + x;
+            sub[n++] = prev && img[i] == prev[i] ? GIF_CLEAR : img[i];
+        }
+
+    /* Graphic control: keep the previous frame, GIF_CLEAR is transparent */
+    FILE *f = z->f;
+    fputs("\x21\xf9\x04", f);
+    putc(1 << 2 | 1, f);
+    put_le16(f, delay);
+    putc(GIF_CLEAR, f);
+    putc(0, f);
+
+    putc(0x2c, f);
+    put_le16(f, x0);
+    put_le16(f, y0);
+    put_le16(f, x1 - x0);
+    put_le16(f, y1 - y0);
+    putc(0, f);
+    lzw_encode(z, sub, n);
+}
+
+static int gif_export(const char *path, int cols, int rows, long nframes) {
+    int w = cols * GIF_CW, h = rows * GIF_CH;
+    if (w > 0xffff || h > 0xffff) {
+        fprintf(stderr, "icosa: %dx%d is too large for a GIF\n", cols, rows);
+        return 1;
+    }
+    struct icosa *ctx = icosa_create(cols, rows, NULL);
+    size_t px = (size_t)w * h;
+    unsigned char *img = malloc(px), *prev = malloc(px), *sub = malloc(px);
+    struct lzw *z = malloc(sizeof(*z));
+    FILE *f = fopen(path, "wb");
+    int status = 1;
+    if (!ctx || !img || !prev || !sub || !z || !f) {
+        fprintf(stderr, "icosa: %s: %s\n", path, f ? "out of memory" : strerror(errno));
+        goto out;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 18);
+    z->f = f;
+
+    fputs("GIF89a", f);
+    put_le16(f, w);
+    put_le16(f, h);
+    putc(0x80 | (GIF_DEPTH - 1) << 4 | (GIF_DEPTH - 1), f); /* global palette */
+    putc(GIF_SKY, f);
+    putc(0, f);
+    fwrite(gif_palette, 1, sizeof(gif_palette), f);
+    fwrite("\x21\xff\x0bNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, f); /* loop forever */
+
+    /* Frame f ends at round(100 f / 30) hundredths, so delays alternate
+     * 3, 3, 4 and the animation keeps real time */
+    for (long i = 0; i < nframes && !stop; i++) {
+        icosa_tick(&anim);
+        *icosa_state(ctx) = anim;
+        icosa_rasterize(ctx);
+        gif_paint(ctx, img, cols, rows);
+        int delay = (int)(((i + 1) * 100 + ICOSA_FPS / 2) / ICOSA_FPS -
+                          (i * 100 + ICOSA_FPS / 2) / ICOSA_FPS);
+        gif_frame(z, img, i ? prev : NULL, sub, w, h, delay);
+        unsigned char *t = prev;
+        prev = img;
+        img = t;
+    }
+    putc(0x3b, f);
+    status = 0;
+
+out:
+    if (f && fclose(f) != 0 && !status) {
+        fprintf(stderr, "icosa: %s: %s\n", path, strerror(errno));
+        status = 1;
+    }
+    free(z);
+    free(sub);
+    free(prev);
+    free(img);
+    icosa_destroy(ctx);
+    return status;
+}
+
+/* Video export (--video FILE): the scene at any pixel resolution, as a
+ * Y4M stream when FILE ends in .y4m and concatenated PPM images
+ * otherwise ("-" is stdout, for piping into an encoder). Frames are
+ * rendered and converted on a pool of threads, each computing its
+ * frame's state from the index alone; the main thread hands out frame
+ * numbers and writes the results back in order. A ring of slots bounds
+ * memory to a few frames per thread. */
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_DONE };
+
+struct vslot {
+    uint32_t frame;
+    unsigned char *out;   /* the frame as written, header included */
+    size_t len;
+    int state;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct vslot *slot;
+    int nslots;
+    long queued, taken;   /* frames handed out, frames claimed */
+    int done;             /* no more frames will be queued */
+    int failed;           /* a worker couldn't get its scratch buffer */
+    int w, h, y4m;
+} vid = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/* Full-range RGB to limited-range BT.601 YCbCr, 4:4:4 planes */
+static void rgb_to_y4m(const unsigned char *rgb, unsigned char *out, size_t px) {
+    unsigned char *py = out, *pu = out + px, *pv = out + 2 * px;
+    for (size_t i = 0; i < px; i++, rgb += 3) {
+        int r = rgb[0], g = rgb[1], b = rgb[2];
+        py[i] = (unsigned char)(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+        pu[i] = (unsigned char)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+        pv[i] = (unsigned char)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+    }
+}
+
+static void *vid_worker(void *arg) {
+    size_t px = (size_t)vid.w * vid.h;
+    unsigned char *rgb = vid.y4m ? malloc(px * 3) : NULL;
+    (void)arg;
+    pthread_mutex_lock(&vid.lock);
+    if (vid.y4m && !rgb) vid.failed = 1;
+    for (;;) {
+        while (vid.taken == vid.queued && !vid.done)
+            pthread_cond_wait(&vid.cond, &vid.lock);
+        if (vid.taken == vid.queued) break;
+        struct vslot *sl = &vid.slot[vid.taken++ % vid.nslots];
+        pthread_mutex_unlock(&vid.lock);
+
+        struct icosa_state s;
+        icosa_state_at(&s, sl->frame);
+        /* The header is already in place; the image goes after it */
+        unsigned char *img = sl->out + sl->len - 3 * px;
+        if (!vid.y4m) {
+            icosa_render_rgb(&s, vid.w, vid.h, img);
+        } else if (rgb) {
+            icosa_render_rgb(&s, vid.w, vid.h, rgb);
+            rgb_to_y4m(rgb, img, px);
+        }
+
+        pthread_mutex_lock(&vid.lock);
+        sl->state = SLOT_DONE;
+        pthread_cond_broadcast(&vid.cond);
+    }
+    pthread_mutex_unlock(&vid.lock);
+    free(rgb);
+    return NULL;
+}
+
+static int video_export(const char *path, int w, int h, long nframes, int nthreads) {
+    size_t n = strlen(path);
+    vid.y4m = n >= 4 && strcmp(path + n - 4, ".y4m") == 0;
+    vid.w = w;
+    vid.h = h;
+    vid.nslots = 2 * nthreads;
+
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "icosa: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    char head[64];
+    int hn = vid.y4m ? snprintf(head, sizeof(head), "FRAME\n")
+                     : snprintf(head, sizeof(head), "P6\n%d %d\n255\n", w, h);
+    size_t frame = (size_t)hn + (size_t)w * h * 3;
+    if (vid.y4m)
+        fprintf(f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", w, h, ICOSA_FPS);
+
+    int status = 1, started = 0;
+    pthread_t *tid = calloc((size_t)nthreads, sizeof(*tid));
+    vid.slot = calloc((size_t)vid.nslots, sizeof(*vid.slot));
+    for (int i = 0; vid.slot && i < vid.nslots; i++) {
+        vid.slot[i].out = malloc(frame);
+        if (!vid.slot[i].out) break;
+        memcpy(vid.slot[i].out, head, (size_t)hn);
+        vid.slot[i].len = frame;
+    }
+    if (!tid || !vid.slot || !vid.slot[vid.nslots - 1].out) {
+        fputs("icosa: out of memory\n", stderr);
+        goto out;
+    }
+    for (; started < nthreads; started++)
+        if (pthread_create(&tid[started], NULL, vid_worker, NULL) != 0) break;
+    if (!started) {
+        fputs("icosa: can't start threads\n", stderr);
+        goto out;
+    }
+
+    status = 0;
+    for (long i = 0; i < nframes && !stop && !status; i++) {
+        pthread_mutex_lock(&vid.lock);
+        /* Keep every slot busy: queue ahead until the ring is full */
+        while (vid.queued < nframes && vid.queued < i + vid.nslots) {
+            struct vslot *sl = &vid.slot[vid.queued % vid.nslots];
+            sl->frame = (uint32_t)vid.queued + 1; /* frame 0 is never shown */
+            sl->state = SLOT_QUEUED;
+            vid.queued++;
+            pthread_cond_broadcast(&vid.cond);
+        }
+        struct vslot *sl = &vid.slot[i % vid.nslots];
+        while (sl->state != SLOT_DONE) pthread_cond_wait(&vid.cond, &vid.lock);
+        int failed = vid.failed;
+        pthread_mutex_unlock(&vid.lock);
+
+        if (failed) {
+            fputs("icosa: out of memory\n", stderr);
+            status = 1;
+        } else if (fwrite(sl->out, 1, sl->len, f) != sl->len) {
+            fprintf(stderr, "icosa: %s: %s\n", path, strerror(errno));
+            status = 1;
+        }
+        sl->state = SLOT_FREE;
+    }
+
+    /* Workers finish whatever was queued, then see done and exit */
+    pthread_mutex_lock(&vid.lock);
+    vid.done = 1;
+    pthread_cond_broadcast(&vid.cond);
+    pthread_mutex_unlock(&vid.lock);
+    for (int i = 0; i < started; i++) pthread_join(tid[i], NULL);
+
+out:
+    if ((f == stdout ? fflush(f) : fclose(f)) != 0 && !status) {
+        fprintf(stderr, "icosa: %s: %s\n", path, strerror(errno));
+        status = 1;
+    }
+    for (int i = 0; vid.slot && i < vid.nslots; i++) free(vid.slot[i].out);
+    free(vid.slot);
+    free(tid);
+    return status;
 }
 
 static void usage(void) {
@@ -157,6 +1749,48 @@ static void usage(void) {
         "\n"
         "Options:\n"
         "  -h, --help    Show this help message\n"
+        "  -l, --loop    Lock the spin to the bounce cycle and replay cached\n"
+        "                frames once it repeats (cheap for repeated greetings)\n"
+        "  -c, --cache   Like --loop, and keep finished loops in\n"
+        "                $XDG_CACHE_HOME/icosa for instant starts next time\n"
+        "  --cache-dir DIR\n"
+        "                Like --cache, with loops kept in DIR\n"
+        "  --shm         Like --loop, and share loops with other running\n"
+        "                instances through POSIX shared memory\n"
+        "  --serve PATH  Run as a daemon animating every client connected to\n"
+        "                the Unix socket PATH from a single simulation\n"
+        "  --connect PATH\n"
+        "                Show the animation from a daemon listening on PATH\n"
+        "  --record FILE Save the output as an asciicast v2 recording\n"
+        "  --headless    Render without a terminal, as fast as possible; the\n"
+        "                output goes to stdout, or only to the --record file\n"
+        "  --gif FILE    Write the animation to FILE as a GIF, headless\n"
+        "  --video FILE  Write the animation as Y4M (FILE ending in .y4m) or\n"
+        "                PPM frames, headless; - for stdout\n"
+        "  --resolution WxH\n"
+        "                Pixel size for --video (default 1280x720)\n"
+        "  --threads N   Threads for --video (default: one per core)\n"
+        "  --size WxH    Terminal size for --headless and --gif (default 80x24)\n"
+        "  --frames N    Stop after N frames (default for exports and\n"
+        "                --headless: 300)\n"
+        "  --fine-floor  Draw the floor at twice the vertical resolution with\n"
+        "                half blocks\n"
+        "  --smooth-floor\n"
+        "                Anti-alias the floor in shades of gray\n"
+        "  --shade       Fade the floor into the distance and dim far edges,\n"
+        "                in 24-bit color if COLORTERM says the terminal can\n"
+        "  --merge N     With --shade, let neighboring cells share a color\n"
+        "                when they differ by at most N of 255 (default 12)\n"
+        "  --cpu-budget PCT\n"
+        "                Keep CPU use under PCT% of a core, lowering the frame\n"
+        "                rate, then detail, then resolution as needed\n"
+        "  --frame-budget MS\n"
+        "                Likewise, keeping each frame under MS of CPU time\n"
+        "  --max-bps N   Send at most N bytes a second, dropping frames and\n"
+        "                falling back to ASCII and no floor on slow links\n"
+        "  --stats       On exit, print frames, fps, bytes written, time spent\n"
+        "                blocked writing, frames skipped and terminal round\n"
+        "                trip to stderr, as JSON\n"
         "\n"
         "Controls:\n"
         "  Any key        Quit\n"
@@ -168,139 +1802,314 @@ static void usage(void) {
 }
 
 int main(int argc, char **argv) {
+    const char *serve_path = NULL, *connect_path = NULL, *rec_path = NULL;
+    const char *gif_path = NULL, *video_path = NULL;
+    int width = 1280, height = 720; /* --resolution, for --video */
+    int nthreads = 0;               /* --threads; 0 = one per core */
+    int cols = 80, rows = 24; /* --size, for --headless */
+    long nframes = -1;        /* --frames; unlimited unless headless */
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             usage();
             return 0;
         }
+        if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--loop") == 0) {
+            loop.on = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cache") == 0) {
+            loop.on = 1;
+            loop.dir = default_cache_dir();
+            if (!loop.dir) {
+                fputs("icosa: no cache directory (set XDG_CACHE_HOME or HOME)\n",
+                      stderr);
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connect_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--shm") == 0) {
+            loop.on = 1;
+            loop.shm = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            loop.on = 1;
+            loop.dir = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            rec_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--gif") == 0 && i + 1 < argc) {
+            gif_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--video") == 0 && i + 1 < argc) {
+            video_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+            char x;
+            if (sscanf(argv[++i], "%d%c%d", &width, &x, &height) != 3 || x != 'x' ||
+                width < 16 || height < 16 || width > 16384 || height > 16384) {
+                fprintf(stderr, "icosa: bad resolution '%s'\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+            if (nthreads < 1 || nthreads > 1024) {
+                fprintf(stderr, "icosa: bad thread count '%s'\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats.on = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--fine-floor") == 0) {
+            look |= ICOSA_FINE_FLOOR;
+            continue;
+        }
+        if (strcmp(argv[i], "--smooth-floor") == 0) {
+            look |= ICOSA_SMOOTH_FLOOR;
+            continue;
+        }
+        if (strcmp(argv[i], "--shade") == 0) {
+            look |= ICOSA_SHADE;
+            continue;
+        }
+        if (strcmp(argv[i], "--merge") == 0 && i + 1 < argc) {
+            char *end;
+            long n = strtol(argv[++i], &end, 10);
+            if (*end || n < 0 || n > 255) {
+                fprintf(stderr, "icosa: bad merge threshold '%s' (0-255)\n", argv[i]);
+                return 1;
+            }
+            merge = (unsigned)n;
+            continue;
+        }
+        if (strcmp(argv[i], "--max-bps") == 0 && i + 1 < argc) {
+            char *end;
+            bps.rate = strtod(argv[++i], &end);
+            if (*end || !(bps.rate >= 100)) {
+                fprintf(stderr, "icosa: bad byte rate '%s' (minimum 100)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        if ((strcmp(argv[i], "--cpu-budget") == 0 || strcmp(argv[i], "--frame-budget") == 0) &&
+            i + 1 < argc) {
+            int cpu = argv[i][2] == 'c';
+            char *end;
+            double v = strtod(argv[++i], &end);
+            if (*end || !(v > 0) || (cpu && v > 100)) {
+                fprintf(stderr, "icosa: bad budget '%s'\n", argv[i]);
+                return 1;
+            }
+            if (cpu) gov.cpu = v / 100;
+            else gov.frame = v / 1000;
+            continue;
+        }
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            char x;
+            if (sscanf(argv[++i], "%d%c%d", &cols, &x, &rows) != 3 || x != 'x' ||
+                cols < ICOSA_MIN_COLS || rows < ICOSA_MIN_ROWS) {
+                fprintf(stderr, "icosa: bad size '%s' (minimum %dx%d)\n", argv[i],
+                        ICOSA_MIN_COLS, ICOSA_MIN_ROWS);
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            char *end;
+            nframes = strtol(argv[++i], &end, 10);
+            if (*end || nframes < 0) {
+                fprintf(stderr, "icosa: bad frame count '%s'\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
         fprintf(stderr, "icosa: unknown option '%s'\n", argv[i]);
         return 1;
     }
 
+    /* Terminals that take 24-bit color say so in COLORTERM */
+    const char *colorterm = getenv("COLORTERM");
+    if ((look & ICOSA_SHADE) && colorterm &&
+        (strcmp(colorterm, "truecolor") == 0 || strcmp(colorterm, "24bit") == 0))
+        look |= ICOSA_TRUECOLOR;
+
+    if (serve_path) return serve(serve_path);
+    icosa_state_init(&anim); /* every mode starts at the top of the bounce */
+    gov.max_level = loop.on ? 1 : GOV_LEVELS - 1;
+    bps.shape = !loop.on;
+
     /* Signal handlers for SIGTERM (from timeout) and SIGINT */
     struct sigaction sa = {0};
     sigemptyset(&sa.sa_mask);
     sa.sa_handler = on_signal;
-    sa.sa_flags = SA_RESETHAND;
     sigaction(SIGTERM, &sa, NULL);
     sigaction(SIGINT, &sa, NULL);
 
-    struct winsize ws;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_col < 20 || ws.ws_row < 10)
-        return 1;
-
-    cw = ws.ws_col;
-    ch = ws.ws_row;
-    pw = cw * 2;
-    ph = ch * 4;
+    /* SIGWINCH only raises a flag; the frame loop picks up the new size */
+    sa.sa_handler = on_winch;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
 
-    fb = calloc((size_t)cw * ch, 1);
-    rbuf = malloc((size_t)ch * ((size_t)cw * 20 + 16) + 64);
-    if (!fb || !rbuf) return 1;
+    if (connect_path) return connect_client(connect_path);
+    if (gif_path || video_path) {
+        headless = 1; /* signals just stop the export */
+        if (nframes < 0) nframes = 10 * ICOSA_FPS;
+        if (!nthreads) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            nthreads = n < 1 ? 1 : n > 1024 ? 1024 : (int)n;
+        }
+        int status = gif_path ? gif_export(gif_path, cols, rows, nframes)
+                              : video_export(video_path, width, height, nframes, nthreads);
+        if (stop) {
+            signal(stop, SIG_DFL);
+            raise(stop);
+        }
+        return status;
+    }
 
-    compute_floor();
+    struct winsize ws;
+    if (headless) {
+        if (nframes < 0) nframes = 10 * ICOSA_FPS;
+    } else if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 ||
+               ws.ws_col < ICOSA_MIN_COLS || ws.ws_row < ICOSA_MIN_ROWS) {
+        return 1;
+    } else {
+        cols = ws.ws_col;
+        rows = ws.ws_row;
+    }
+    if (open_size(cols, rows) < 0) return 1;
+    if (rec_path && rec_open(rec_path, cols, rows) < 0) {
+        fprintf(stderr, "icosa: %s: %s\n", rec_path, strerror(errno));
+        return 1;
+    }
 
-    /* Raw mode so any keypress (including ctrl-c) is readable as input */
-    tcgetattr(STDIN_FILENO, &orig_tios);
-    struct termios raw = orig_tios;
-    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
-    raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 0;
-    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    /* A closed stdout ends the run rather than killing it */
+    signal(SIGPIPE, SIG_IGN);
+    if (!headless) {
+        sa.sa_handler = on_tty_signal;
+        sa.sa_flags = 0; /* interrupt the call, don't restart it */
+        sigaction(SIGTTOU, &sa, NULL);
+        sigaction(SIGTTIN, &sa, NULL);
+        sigaction(SIGCONT, &sa, NULL);
+        wait_foreground(); /* started with &: not until fg */
+        flow.on = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+        setup_terminal();
+    }
 
-    fputs("\033[?1049h\033[?25l\033[2J", stdout);
-    fflush(stdout);
-
-    float scale = fminf((float)pw, (float)ph) * 0.45f;
-    float center_x = (float)pw / 2.0f;
-    float floor_py = (float)(horizon * 4); /* horizon in braille pixels */
-
-    /* Physics in braille-pixel units — scales with terminal size */
-    float max_bounce = floor_py * 0.55f;  /* max bounce height in pixels */
-    float fall_frames = 22.0f;            /* frames to fall from max (~0.7s) */
-    float grav = 2.0f * max_bounce / (fall_frames * fall_frames);
-    float restart_vel = sqrtf(2.0f * max_bounce * grav);
-    float pos = max_bounce;  /* start at top of bounce */
-    float vel = 0;
-    const float damp = 0.82f;
-    float squash = 0;
-    const float squash_decay = 0.70f;
-
-    float ax = 0, ay = 0, az = 0;
     struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    struct timespec start, next;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    next = start;
+
+    /* Headless runs take no input and don't pace themselves: frame f is
+     * stamped f/30 s, so they finish as fast as frames can be made */
+    for (long frame = 0; frame != nframes && !stop; frame++) {
+        if (!headless && (hidden || !foreground())) {
+            if (!wait_foreground()) break;
+            setup_terminal();
+            hidden = 0;
+            flow.inflight = 0; /* the shell had the answers */
+            repaint = winch = 1;
+        }
+        if (out_gone) break;
 
-    for (;;) {
         /* Any keypress = exit */
-        if (poll(&pfd, 1, 0) > 0)
+        if (!headless && ((poll(&pfd, 1, 0) > 0 && input_ready(&pfd)) || lone_escape()))
             break;
 
-        fb_clear();
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        rec.t = headless ? (double)frame / ICOSA_FPS
+                         : (double)(now.tv_sec - start.tv_sec) +
+                               (double)(now.tv_nsec - start.tv_nsec) / 1e9;
 
-        /* Gravity and bounce (all in braille-pixel units) */
-        vel -= grav;
-        pos += vel;
-        if (pos <= 0) {
-            pos = 0;
-            squash = fminf(fabsf(vel) / restart_vel * 0.5f, 0.5f);
-            vel = fabsf(vel) * damp;
-            if (vel < grav * 8.0f) vel = restart_vel;
+        /* Resize at most once per frame, however many SIGWINCHs arrived.
+         * Below the minimum size the last good geometry is kept. */
+        if (winch && !headless) {
+            winch = 0;
+            if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 &&
+                ws.ws_col >= ICOSA_MIN_COLS && ws.ws_row >= ICOSA_MIN_ROWS &&
+                (ws.ws_col != tcols || ws.ws_row != trows)) {
+                if (open_size(ws.ws_col, ws.ws_row) < 0) break;
+                rec_resize(ws.ws_col, ws.ws_row);
+            }
         }
-        squash *= squash_decay;
-
-        float yscale = 1.0f - squash;
-        float xzscale = 1.0f + squash * 0.5f;
-
-        /* Object center: centered horizontally, bounces vertically */
-        float obj_cx = center_x;
-        float obj_cy = floor_py - pos - scale * 0.2f;
-
-        float s1 = sinf(ax), c1 = cosf(ax);
-        float s2 = sinf(ay), c2 = cosf(ay);
-        float s3 = sinf(az), c3 = cosf(az);
-
-        float proj[NVERTS][2];
-        for (int i = 0; i < NVERTS; i++) {
-            float x = base_verts[i][0];
-            float y = base_verts[i][1];
-            float z = base_verts[i][2];
-
-            /* Rotate */
-            float y1 = y * c1 - z * s1;
-            float z1 = y * s1 + z * c1;
-            float x2 = x * c2 + z1 * s2;
-            float z2 = -x * s2 + z1 * c2;
-            float x3 = x2 * c3 - y1 * s3;
-            float y3 = x2 * s3 + y1 * c3;
-
-            /* Squash/stretch in screen space (vertical squash on impact) */
-            x3 *= xzscale;
-            y3 *= yscale;
-
-            /* Perspective */
-            float d = 5.0f + z2 * 0.3f;
-            proj[i][0] = obj_cx + (x3 / d) * scale;
-            proj[i][1] = obj_cy + (y3 / d) * scale;
+        gov_update();
+        bps_update();
+        int skip = frame % gov_levels[gov.level].every; /* governor */
+        int paced = flow_blocked();
+        if (!paced && !skip) paced = bps_blocked();
+        int drop = paced || skip;
+        if (repaint && !drop) {
+            static const char clear[] = SYNC_BEGIN "\033[2J";
+            output(clear, sizeof(clear) - 1);
+            if (tv) icosa_invalidate(tv);
+            repaint = 0;
         }
 
-        for (int i = 0; i < NEDGES; i++)
-            draw_line((int)proj[edges[i][0]][0], (int)proj[edges[i][0]][1],
-                      (int)proj[edges[i][1]][0], (int)proj[edges[i][1]][1]);
-
-        render();
-
-        ax += 0.05f;
-        ay += 0.07f;
-        az += 0.03f;
+        if (!loop.map) icosa_tick(&anim);
+        if ((!loop.on || loop_frame(drop) < 0) && !drop) {
+            struct icosa *ctx = term_view();
+            if (!ctx) break;
+            render(ctx, &anim);
+        }
+        if (paced) stats.dropped++;
+        else if (!drop) flow_probe();
+        gov.drawn += !drop;
+        rec_frame_end();
+        stats_frame_end(!drop);
 
         /* Frame delay ~30fps — use poll as the timer */
-        poll(&pfd, 1, 33);
-        if (pfd.revents & POLLIN)
+        if (!headless && wait_frame(&next, &pfd))
             break;
     }
 
-    cleanup_terminal();
-    free(fb);
-    free(rbuf);
-    free(floor_map);
-    return 0;
+    if (!headless) {
+        flow_drain();
+        cleanup_terminal();
+    }
+    stats_report(mono_now() - ((double)start.tv_sec + (double)start.tv_nsec / 1e9));
+    int status = 0;
+    if (rec.f) {
+        rec_frame_end();
+        if (fclose(rec.f) != 0) {
+            fprintf(stderr, "icosa: %s: %s\n", rec_path, strerror(errno));
+            status = 1;
+        }
+    }
+    icosa_destroy(tv);
+    free(obuf);
+    if (loop.map) {
+        loop_unmap();
+    } else {
+        free(loop.bytes);
+        free(loop.off);
+    }
+    if (stop) {
+        signal(stop, SIG_DFL);
+        raise(stop);
+    }
+    return status;
 }
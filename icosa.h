@@ -0,0 +1,181 @@
+/* icosa.h — Embeddable icosa renderer
+ *
+ * A context renders the bouncing glenz vector for one terminal size into
+ * buffers the caller provides; nothing is written to any file descriptor
+ * and there is no global state, so any number of contexts can run in one
+ * process. A typical frame:
+ *
+ *     icosa_step(ctx, dt);
+ *     icosa_rasterize(ctx);
+ *     while ((n = icosa_encode(ctx, buf, sizeof(buf))) > 0)
+ *         write(fd, buf, n);
+ */
+#ifndef ICOSA_H
+#define ICOSA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define ICOSA_MIN_COLS 20
+#define ICOSA_MIN_ROWS 10
+#define ICOSA_FPS 30 /* the animation advances in whole frames at this rate */
+
+/* Animation state. Plain data, so it can be snapshotted, restored, or
+ * copied between contexts to drive several sizes from one simulation.
+ * The simulation itself runs on the integer fields; the floats are
+ * derived from them on every change and are what gets drawn. */
+struct icosa_state {
+    float pos, vel, squash; /* bounce, in units of the maximum height */
+    float rot[3];           /* x, y, z rotation angles */
+    uint32_t frame;         /* frames since the start */
+    int32_t ipos, ivel;     /* fixed-point bounce height and speed */
+    int32_t isquash;
+};
+
+#define ICOSA_NO_SYNC 1u /* don't bracket frames in a synchronized update */
+/* Write only the cells that changed since the previous frame, moving the
+ * cursor with CUP. The first frame, and the first after a resize or
+ * icosa_invalidate(), is written in full. */
+#define ICOSA_DIFF 2u
+/* Send runs of identical cells once and repeat them with REP (CSI b),
+ * and erase blank runs at the right edge with ECH (CSI X); the terminal
+ * must support both */
+#define ICOSA_RLE 4u
+/* Cheaper drawing: leave out edges wholly behind the object's center, and
+ * draw lines at half resolution, each point a 2x2 block of dots */
+#define ICOSA_NO_BACK 8u
+#define ICOSA_HALF_RES 16u
+/* Cheaper output: the object in plain ASCII (one byte a cell instead of
+ * three) and no floor, only sky */
+#define ICOSA_ASCII 32u
+#define ICOSA_NO_FLOOR 64u
+/* The floor at twice the vertical resolution, each cell split into an
+ * upper and a lower half block in their own colors. Its rows are encoded
+ * once per size, so it costs little more per frame than the plain one. */
+#define ICOSA_FINE_FLOOR 128u
+/* The floor anti-aliased: each cell the average of 4x4 samples, in the
+ * grays between its two colors. ICOSA_FINE_FLOOR takes precedence. */
+#define ICOSA_SMOOTH_FLOOR 256u
+/* Depth shading: the floor fades into the sky with distance, and edges
+ * dim the further back they are. Colors are the 256-color palette's
+ * nearest, or with ICOSA_TRUECOLOR exact 24-bit ones. The floor keeps
+ * its plain colors under ICOSA_FINE_FLOOR and ICOSA_SMOOTH_FLOOR. */
+#define ICOSA_SHADE 512u
+#define ICOSA_TRUECOLOR 1024u
+
+/* Cell glyph sets. Which one a library draws with is fixed when it is
+ * built (make GLYPHS=sextant); icosa_glyphs() says which. */
+#define ICOSA_GLYPHS_BRAILLE 0  /* 2x4 braille dots, 3 bytes a cell */
+#define ICOSA_GLYPHS_OCTANT 1   /* 2x4 blocks, Unicode 16 octants, 3-4 bytes */
+#define ICOSA_GLYPHS_SEXTANT 2  /* 2x3 blocks, U+1FB00 sextants, 3-4 bytes */
+#define ICOSA_GLYPHS_QUADRANT 3 /* 2x2 quadrant blocks, 3 bytes */
+#define ICOSA_GLYPHS_HALF 4     /* 1x2 upper and lower half blocks, 3 bytes */
+#define ICOSA_GLYPHS_ASCII 5    /* 2x2, the nearest ASCII character, 1 byte */
+
+struct icosa_opts {
+    unsigned flags; /* ICOSA_* flags above */
+    /* ICOSA_SHADE: along a row of floor, or of the object, a cell within
+     * merge (0-255, in each of red, green and blue) of the color starting
+     * its run takes that color, so the run needs only one SGR. 0 merges
+     * only colors that look the same. */
+    unsigned merge;
+};
+
+struct icosa;
+
+/* Create a context for a cols x rows terminal; opts may be NULL. Returns
+ * NULL if the size is below the minimum or memory can't be had. */
+struct icosa *icosa_create(int cols, int rows, const struct icosa_opts *opts);
+void icosa_destroy(struct icosa *ctx);
+
+/* Change the size, keeping the animation state. Buffers only grow, by
+ * doubling; those only some flags use are made by icosa_rasterize(). */
+int icosa_resize(struct icosa *ctx, int cols, int rows);
+void icosa_get_size(const struct icosa *ctx, int *cols, int *rows);
+
+/* Change the options; they apply from the next icosa_rasterize() */
+void icosa_set_flags(struct icosa *ctx, unsigned flags);
+unsigned icosa_get_flags(const struct icosa *ctx);
+
+/* The context's animation state, for reading or overwriting */
+struct icosa_state *icosa_state(struct icosa *ctx);
+
+/* The state at the start of the animation: the object at the top of its
+ * bounce, unrotated */
+void icosa_state_init(struct icosa_state *s);
+
+/* Advance a state by one frame. Returns 1 when the bounce has run out of
+ * energy and restarts from the floor. */
+int icosa_tick(struct icosa_state *s);
+
+/* The state at any frame, computed directly rather than by stepping,
+ * and bit-for-bit the state icosa_tick() reaches from the start */
+void icosa_state_at(struct icosa_state *s, uint32_t frame);
+
+/* Jump the context to t seconds from the start */
+void icosa_seek(struct icosa *ctx, double t);
+
+/* From frame start on, the bounce (everything but frame and rot) repeats
+ * every len frames */
+void icosa_cycle(uint32_t *start, uint32_t *len);
+
+/* Advance the context by dt seconds, in whole frames; the remainder is
+ * carried to the next call. Returns the number of frames advanced. */
+int icosa_step(struct icosa *ctx, double dt);
+
+/* Rotation added per frame about x, y and z */
+void icosa_spin(float spin[3]);
+
+/* Draw the current state, and restart encoding at the top of the frame */
+void icosa_rasterize(struct icosa *ctx);
+
+/* The terminal no longer shows what the context last sent (it was cleared
+ * or written over), so with ICOSA_DIFF the next frame is written in full;
+ * that includes a frame rasterized but not yet encoded */
+void icosa_invalidate(struct icosa *ctx);
+
+/* The rasterized frame as cells, row-major: dot bits (0 where the object
+ * isn't) and the floor (0 sky, 1 dark, 2 light). For drawing the scene
+ * some other way than as terminal output. */
+void icosa_cells(const struct icosa *ctx, const unsigned char **dots,
+                 const unsigned char **floor);
+
+/* The glyph set built in, its cells' size in dots, and the bit in a
+ * cell's dots for the dot x across and y down */
+int icosa_glyphs(void);
+void icosa_cell_dots(int *w, int *h);
+unsigned icosa_dot_bit(int x, int y);
+
+/* Render state s as a w x h RGB image (3 bytes per pixel, top row first)
+ * with square pixels, independent of any terminal. It needs no context
+ * and shares nothing, so frames can be rendered on several threads. */
+void icosa_render_rgb(const struct icosa_state *s, int w, int h, unsigned char *rgb);
+
+/* Encode the rasterized frame into buf, continuing where the previous call
+ * stopped. Only whole rows are written, so cap must be at least
+ * icosa_chunk_min(cols); a buffer of icosa_frame_bound(cols, rows) takes
+ * the frame in one call. Returns the bytes written, 0 once the frame is
+ * complete (or if cap is too small to make progress). */
+size_t icosa_encode(struct icosa *ctx, char *buf, size_t cap);
+
+/* The bytes icosa_encode() would write for the rest of the frame, or with
+ * whole set, for all of it written in full; nothing changes. For choosing
+ * how to send a frame before sending it. */
+size_t icosa_measure(struct icosa *ctx, int whole);
+
+/* Encode into the buffers of iov in turn, setting each iov_len to the bytes
+ * written there, ready for writev(). Returns the number of buffers used;
+ * fewer than iovcnt means the frame is complete. */
+int icosa_encode_iov(struct icosa *ctx, struct iovec *iov, int iovcnt);
+
+/* Upper bounds on encoded sizes: a whole frame, and the smallest buffer
+ * icosa_encode() can always make progress with */
+size_t icosa_frame_bound(int cols, int rows);
+size_t icosa_chunk_min(int cols);
+
+/* Changes whenever the same state, size and options would encode to
+ * different bytes, for keying caches of encoded frames */
+uint64_t icosa_version(void);
+
+#endif
@@ -0,0 +1,1290 @@
+/* libicosa.c — Bouncing glenz vector over a checkerboard floor
+ * The scene, its physics and the terminal encoder, rendering into caller
+ * buffers. See icosa.h for the interface; icosa.c is the command-line
+ * front end.
+ */
+
+#include "icosa.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Cell glyphs, chosen when the library is built (make GLYPHS=...). Each
+ * set splits a cell into CELL_W x CELL_H dots, bit y * CELL_W + x of a
+ * cell's byte, except braille, whose bits follow the Unicode dot order.
+ * glyph_cp maps a cell's bits to its code point, GLYPH_MAX is the longest
+ * in UTF-8, and ASPECT is how much taller than wide a dot is, taking a
+ * cell to be twice as tall as it is wide. */
+#ifndef ICOSA_GLYPHS
+#define ICOSA_GLYPHS ICOSA_GLYPHS_BRAILLE
+#endif
+
+#if ICOSA_GLYPHS == ICOSA_GLYPHS_BRAILLE
+#define CELL_W 2
+#define CELL_H 4
+#define GLYPH_MAX 3
+static const unsigned char braille_bits[2][4] = {
+    {0x01, 0x02, 0x04, 0x40},
+    {0x08, 0x10, 0x20, 0x80}
+};
+#elif ICOSA_GLYPHS == ICOSA_GLYPHS_OCTANT
+#define CELL_W 2
+#define CELL_H 4
+#define GLYPH_MAX 4
+/* U+1CD00 holds the patterns that had no character already: blocks,
+ * quadrants, halves and quarters are used where they exist */
+static const uint32_t glyph_cp[256] = {
+    0x00020, 0x1cea8, 0x1ceab, 0x1fb82, 0x1cd00, 0x02598, 0x1cd01, 0x1cd02,
+    0x1cd03, 0x1cd04, 0x0259d, 0x1cd05, 0x1cd06, 0x1cd07, 0x1cd08, 0x02580,
+    0x1cd09, 0x1cd0a, 0x1cd0b, 0x1cd0c, 0x1fbe6, 0x1cd0d, 0x1cd0e, 0x1cd0f,
+    0x1cd10, 0x1cd11, 0x1cd12, 0x1cd13, 0x1cd14, 0x1cd15, 0x1cd16, 0x1cd17,
+    0x1cd18, 0x1cd19, 0x1cd1a, 0x1cd1b, 0x1cd1c, 0x1cd1d, 0x1cd1e, 0x1cd1f,
+    0x1fbe7, 0x1cd20, 0x1cd21, 0x1cd22, 0x1cd23, 0x1cd24, 0x1cd25, 0x1cd26,
+    0x1cd27, 0x1cd28, 0x1cd29, 0x1cd2a, 0x1cd2b, 0x1cd2c, 0x1cd2d, 0x1cd2e,
+    0x1cd2f, 0x1cd30, 0x1cd31, 0x1cd32, 0x1cd33, 0x1cd34, 0x1cd35, 0x1fb85,
+    0x1cea3, 0x1cd36, 0x1cd37, 0x1cd38, 0x1cd39, 0x1cd3a, 0x1cd3b, 0x1cd3c,
+    0x1cd3d, 0x1cd3e, 0x1cd3f, 0x1cd40, 0x1cd41, 0x1cd42, 0x1cd43, 0x1cd44,
+    0x02596, 0x1cd45, 0x1cd46, 0x1cd47, 0x1cd48, 0x0258c, 0x1cd49, 0x1cd4a,
+    0x1cd4b, 0x1cd4c, 0x0259e, 0x1cd4d, 0x1cd4e, 0x1cd4f, 0x1cd50, 0x0259b,
+    0x1cd51, 0x1cd52, 0x1cd53, 0x1cd54, 0x1cd55, 0x1cd56, 0x1cd57, 0x1cd58,
+    0x1cd59, 0x1cd5a, 0x1cd5b, 0x1cd5c, 0x1cd5d, 0x1cd5e, 0x1cd5f, 0x1cd60,
+    0x1cd61, 0x1cd62, 0x1cd63, 0x1cd64, 0x1cd65, 0x1cd66, 0x1cd67, 0x1cd68,
+    0x1cd69, 0x1cd6a, 0x1cd6b, 0x1cd6c, 0x1cd6d, 0x1cd6e, 0x1cd6f, 0x1cd70,
+    0x1cea0, 0x1cd71, 0x1cd72, 0x1cd73, 0x1cd74, 0x1cd75, 0x1cd76, 0x1cd77,
+    0x1cd78, 0x1cd79, 0x1cd7a, 0x1cd7b, 0x1cd7c, 0x1cd7d, 0x1cd7e, 0x1cd7f,
+    0x1cd80, 0x1cd81, 0x1cd82, 0x1cd83, 0x1cd84, 0x1cd85, 0x1cd86, 0x1cd87,
+    0x1cd88, 0x1cd89, 0x1cd8a, 0x1cd8b, 0x1cd8c, 0x1cd8d, 0x1cd8e, 0x1cd8f,
+    0x02597, 0x1cd90, 0x1cd91, 0x1cd92, 0x1cd93, 0x0259a, 0x1cd94, 0x1cd95,
+    0x1cd96, 0x1cd97, 0x02590, 0x1cd98, 0x1cd99, 0x1cd9a, 0x1cd9b, 0x0259c,
+    0x1cd9c, 0x1cd9d, 0x1cd9e, 0x1cd9f, 0x1cda0, 0x1cda1, 0x1cda2, 0x1cda3,
+    0x1cda4, 0x1cda5, 0x1cda6, 0x1cda7, 0x1cda8, 0x1cda9, 0x1cdaa, 0x1cdab,
+    0x02582, 0x1cdac, 0x1cdad, 0x1cdae, 0x1cdaf, 0x1cdb0, 0x1cdb1, 0x1cdb2,
+    0x1cdb3, 0x1cdb4, 0x1cdb5, 0x1cdb6, 0x1cdb7, 0x1cdb8, 0x1cdb9, 0x1cdba,
+    0x1cdbb, 0x1cdbc, 0x1cdbd, 0x1cdbe, 0x1cdbf, 0x1cdc0, 0x1cdc1, 0x1cdc2,
+    0x1cdc3, 0x1cdc4, 0x1cdc5, 0x1cdc6, 0x1cdc7, 0x1cdc8, 0x1cdc9, 0x1cdca,
+    0x1cdcb, 0x1cdcc, 0x1cdcd, 0x1cdce, 0x1cdcf, 0x1cdd0, 0x1cdd1, 0x1cdd2,
+    0x1cdd3, 0x1cdd4, 0x1cdd5, 0x1cdd6, 0x1cdd7, 0x1cdd8, 0x1cdd9, 0x1cdda,
+    0x02584, 0x1cddb, 0x1cddc, 0x1cddd, 0x1cdde, 0x02599, 0x1cddf, 0x1cde0,
+    0x1cde1, 0x1cde2, 0x0259f, 0x1cde3, 0x02586, 0x1cde4, 0x1cde5, 0x02588,
+};
+#elif ICOSA_GLYPHS == ICOSA_GLYPHS_SEXTANT
+#define CELL_W 2
+#define CELL_H 3
+#define GLYPH_MAX 4
+/* U+1FB00 in order, leaving out the halves and the full block */
+static const uint32_t glyph_cp[64] = {
+    0x00020, 0x1fb00, 0x1fb01, 0x1fb02, 0x1fb03, 0x1fb04, 0x1fb05, 0x1fb06,
+    0x1fb07, 0x1fb08, 0x1fb09, 0x1fb0a, 0x1fb0b, 0x1fb0c, 0x1fb0d, 0x1fb0e,
+    0x1fb0f, 0x1fb10, 0x1fb11, 0x1fb12, 0x1fb13, 0x0258c, 0x1fb14, 0x1fb15,
+    0x1fb16, 0x1fb17, 0x1fb18, 0x1fb19, 0x1fb1a, 0x1fb1b, 0x1fb1c, 0x1fb1d,
+    0x1fb1e, 0x1fb1f, 0x1fb20, 0x1fb21, 0x1fb22, 0x1fb23, 0x1fb24, 0x1fb25,
+    0x1fb26, 0x1fb27, 0x02590, 0x1fb28, 0x1fb29, 0x1fb2a, 0x1fb2b, 0x1fb2c,
+    0x1fb2d, 0x1fb2e, 0x1fb2f, 0x1fb30, 0x1fb31, 0x1fb32, 0x1fb33, 0x1fb34,
+    0x1fb35, 0x1fb36, 0x1fb37, 0x1fb38, 0x1fb39, 0x1fb3a, 0x1fb3b, 0x02588,
+};
+#elif ICOSA_GLYPHS == ICOSA_GLYPHS_QUADRANT
+#define CELL_W 2
+#define CELL_H 2
+#define GLYPH_MAX 3
+static const uint32_t glyph_cp[16] = {
+    0x0020, 0x2598, 0x259d, 0x2580, 0x2596, 0x258c, 0x259e, 0x259b,
+    0x2597, 0x259a, 0x2590, 0x259c, 0x2584, 0x2599, 0x259f, 0x2588,
+};
+#elif ICOSA_GLYPHS == ICOSA_GLYPHS_HALF
+#define CELL_W 1
+#define CELL_H 2
+#define GLYPH_MAX 3
+static const uint32_t glyph_cp[4] = { 0x0020, 0x2580, 0x2584, 0x2588 };
+#elif ICOSA_GLYPHS == ICOSA_GLYPHS_ASCII
+#define CELL_W 2
+#define CELL_H 2
+#define GLYPH_MAX 1
+#else
+#error "unknown ICOSA_GLYPHS"
+#endif
+#define ASPECT (2.0f * CELL_W / CELL_H)
+
+/* Tetrakis hexahedron: cube + pyramid on each face */
+#define NVERTS 14
+#define NEDGES 36
+#define PYR 1.5f /* pyramid tip distance from center */
+
+static const float base_verts[NVERTS][3] = {
+    /* Cube corners (0-7) */
+    { 1,  1,  1}, { 1,  1, -1}, { 1, -1,  1}, { 1, -1, -1},
+    {-1,  1,  1}, {-1,  1, -1}, {-1, -1,  1}, {-1, -1, -1},
+    /* Pyramid tips: +x, -x, +y, -y, +z, -z (8-13) */
+    {PYR, 0, 0}, {-PYR, 0, 0},
+    {0, PYR, 0}, {0, -PYR, 0},
+    {0, 0, PYR}, {0, 0, -PYR}
+};
+
+static const int edges[NEDGES][2] = {
+    /* Cube edges (12) */
+    {0,1},{0,2},{0,4},{1,3},{1,5},{2,3},{2,6},{3,7},{4,5},{4,6},{5,7},{6,7},
+    /* +x face → tip 8 */  {8,0},{8,1},{8,2},{8,3},
+    /* -x face → tip 9 */  {9,4},{9,5},{9,6},{9,7},
+    /* +y face → tip 10 */ {10,0},{10,1},{10,4},{10,5},
+    /* -y face → tip 11 */ {11,2},{11,3},{11,6},{11,7},
+    /* +z face → tip 12 */ {12,0},{12,2},{12,4},{12,6},
+    /* -z face → tip 13 */ {13,1},{13,3},{13,5},{13,7}
+};
+
+/* ICOSA_SHADE's levels each of the dark floor, the light floor and the
+ * object */
+#define SHADES 32
+#define SHADE_MODES (3 * SHADES)
+
+/* Everything that depends on the terminal size, plus the animation */
+struct icosa {
+    int cw, ch;
+    int pw, ph;
+    int horizon;
+    unsigned char *fb;        /* dot framebuffer, a byte per cell */
+    unsigned char *floor_map; /* per-cell: 0=sky, 1=dark, 2=light */
+    unsigned char *floor_mode; /* ICOSA_FINE_FLOOR: per-cell mode, halves */
+    unsigned char *floor_aa;  /* ICOSA_SMOOTH_FLOOR: per-cell mode, grays */
+    unsigned char *floor_fog; /* ICOSA_SHADE: per-cell mode, fogged */
+    unsigned char *tone;      /* ICOSA_SHADE: per-cell mode, as drawn */
+    unsigned char *prev;      /* ICOSA_DIFF: fb as the terminal last saw it */
+    unsigned char *prev_tone; /* and tone */
+    unsigned char *arena;     /* backs fb, floor_map and prev */
+    size_t arena_cap;         /* grown by doubling */
+    unsigned char *tones;     /* backs floor_fog, tone and prev_tone */
+    size_t floor_mode_cap, floor_aa_cap, tones_cap;
+    unsigned stale;           /* flags whose tables aren't made at this size */
+    char *runs;               /* ICOSA_FINE_FLOOR: every row's floor, encoded */
+    uint32_t *run_off;        /* row y, cell x starts at runs[run_off[y*(cw+1)+x]] */
+    size_t runs_cap, run_off_cap; /* bytes */
+    char *scratch;            /* icosa_measure(): output that is thrown away */
+    size_t scratch_cap;
+    float scale, center_x, floor_py, max_bounce; /* dots, vertically */
+
+    unsigned char shade_rgb[2][SHADE_MODES][3]; /* shaded modes' colors, 256 and 24-bit */
+    unsigned char shade_pal[SHADE_MODES];       /* and their palette entries */
+
+    struct icosa_state state;
+    double acc;               /* time not yet turned into frames */
+    unsigned flags;
+    unsigned merge;           /* ICOSA_SHADE: see icosa_opts */
+    int row;                  /* next row icosa_encode() writes */
+    int full;                 /* this frame is written in full */
+    int fresh;                /* prev matches the terminal */
+    int opened;               /* this frame's header has been written */
+    int sgr;                  /* ICOSA_DIFF: cell mode the terminal is in */
+    int dry;                  /* icosa_measure(): leave prev and fresh be */
+};
+
+/* The bounce is simulated in integers, in fractions of the maximum bounce
+ * height, so one simulation can drive views of any size and any frame's
+ * state can be computed directly (icosa_state_at) with exactly the result
+ * of stepping there. Falling from the top takes FALL_FRAMES frames. */
+#define FALL_FRAMES 22                            /* ~0.7s */
+#define GRAV 8192                                 /* per frame, per frame */
+#define HEIGHT (GRAV * FALL_FRAMES * FALL_FRAMES / 2) /* the maximum */
+#define RESTART_VEL (FALL_FRAMES * GRAV)          /* sqrt(2 * GRAV * HEIGHT) */
+#define SQUASH_ONE 65536                          /* squash fixed point */
+static const float spin[3] = { 0.05f, 0.07f, 0.03f }; /* per frame */
+
+static void fb_clear(struct icosa *v) { memset(v->fb, 0, (size_t)v->cw * v->ch); }
+
+static void fb_set(struct icosa *v, int x, int y) {
+    if (x < 0 || x >= v->pw || y < 0 || y >= v->ph) return;
+#if ICOSA_GLYPHS == ICOSA_GLYPHS_BRAILLE
+    v->fb[(y / 4) * v->cw + (x / 2)] |= braille_bits[x & 1][y & 3];
+#else
+    v->fb[(y / CELL_H) * v->cw + x / CELL_W] |= (unsigned char)(1u << (y % CELL_H * CELL_W + x % CELL_W));
+#endif
+}
+
+/* fb_set, and with lit, raise the cell's tone to level */
+static inline __attribute__((always_inline)) void
+plot(struct icosa *v, int x, int y, int lit, int level) {
+    fb_set(v, x, y);
+    if (!lit || x < 0 || x >= v->pw || y < 0 || y >= v->ph) return;
+    unsigned char *t = &v->tone[(y / CELL_H) * v->cw + x / CELL_W];
+    if (level > *t) *t = (unsigned char)level;
+}
+
+/* Bresenham. With half set, the line is in half-resolution pixels and
+ * each point is a 2x2 block of dots. With lit, the tone goes from l0 to
+ * l1 along it, in 16.16 fixed point. Callers pass constants for half and
+ * lit, so each combination gets its own loop. */
+static inline __attribute__((always_inline)) void
+walk_line(struct icosa *v, int x0, int y0, int x1, int y1, int half, int lit,
+          int32_t l0, int32_t l1) {
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy, n = dx > -dy ? dx : -dy;
+    int32_t l = l0, dl = lit && n ? (l1 - l0) / n : 0;
+    for (;;) {
+        int level = (l + 0x8000) >> 16;
+        if (half) {
+            plot(v, 2 * x0, 2 * y0, lit, level);
+            plot(v, 2 * x0 + 1, 2 * y0, lit, level);
+            plot(v, 2 * x0, 2 * y0 + 1, lit, level);
+            plot(v, 2 * x0 + 1, 2 * y0 + 1, lit, level);
+        } else {
+            plot(v, x0, y0, lit, level);
+        }
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x0 += sx; }
+        if (e2 <= dx) { err += dx; y0 += sy; }
+        l += dl;
+    }
+}
+
+static void draw_line(struct icosa *v, int x0, int y0, int x1, int y1) {
+    walk_line(v, x0, y0, x1, y1, 0, 0, 0, 0);
+}
+
+static void draw_line_half(struct icosa *v, int x0, int y0, int x1, int y1) {
+    walk_line(v, x0, y0, x1, y1, 1, 0, 0, 0);
+}
+
+static void draw_line_lit(struct icosa *v, int x0, int y0, int x1, int y1,
+                          int32_t l0, int32_t l1) {
+    walk_line(v, x0, y0, x1, y1, 0, 1, l0, l1);
+}
+
+static void draw_line_half_lit(struct icosa *v, int x0, int y0, int x1, int y1,
+                               int32_t l0, int32_t l1) {
+    walk_line(v, x0, y0, x1, y1, 1, 1, l0, l1);
+}
+
+/* Cell modes: 0=sky, 1=dark floor, 2=light floor, 3=object. With
+ * ICOSA_FINE_FLOOR a floor cell whose halves differ is a half block in
+ * mode MODE_HALF + top * 3 + bottom: the upper half in the top color over
+ * the bottom one, or the lower half over the sky. The gaps are halves
+ * alike. With ICOSA_SMOOTH_FLOOR a cell between light and dark is blank in
+ * mode MODE_GRAY + j, gray 236 + j of the 256-color ramp. */
+#define MODE_HALF 4
+#define MODE_GRAY 13
+#define MODES 30
+static const char *const mode_sgr[MODES] = {
+    "\033[0m", "\033[48;5;236m", "\033[48;5;252m", "\033[0;96m",
+    NULL, "\033[0;38;5;236m", "\033[0;38;5;252m",
+    "\033[0;38;5;236m", NULL, "\033[38;5;236;48;5;252m",
+    "\033[0;38;5;252m", "\033[38;5;252;48;5;236m", NULL,
+    "\033[48;5;236m", "\033[48;5;237m", "\033[48;5;238m", "\033[48;5;239m",
+    "\033[48;5;240m", "\033[48;5;241m", "\033[48;5;242m", "\033[48;5;243m",
+    "\033[48;5;244m", "\033[48;5;245m", "\033[48;5;246m", "\033[48;5;247m",
+    "\033[48;5;248m", "\033[48;5;249m", "\033[48;5;250m", "\033[48;5;251m",
+    "\033[48;5;252m",
+};
+
+/* ICOSA_SHADE adds the modes MODE_FOG + kind * SHADES + level, kind 0
+ * the dark floor, 1 the light floor, 2 the object (MODE_EDGE on). The
+ * floor blends from the sky at level 0 to its own color, the object from
+ * a quarter of its brightness to all of it. Their SGR is made up as it
+ * goes out, from the context's table of their colors. */
+#define MODE_FOG MODES
+#define MODE_EDGE (MODE_FOG + 2 * SHADES)
+#define SHADE_SGR_MAX (sizeof("\033[0;38;2;255;255;255m") - 1)
+
+/* The terminal's colors: sky, dark floor (236), light floor (252) and
+ * the object (bright cyan, 96) */
+static const unsigned char rgb_color[4][3] = {
+    {0x00, 0x00, 0x00}, {0x30, 0x30, 0x30}, {0xd0, 0xd0, 0xd0}, {0x00, 0xff, 0xff}
+};
+
+#define HALF_UPPER "\xe2\x96\x80" /* U+2580 */
+#define HALF_LOWER "\xe2\x96\x84" /* U+2584 */
+
+static char *put_str(char *p, const char *s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+static char *put_uint(char *p, unsigned n) {
+    char d[10];
+    int i = 0;
+    do d[i++] = (char)('0' + n % 10); while (n /= 10);
+    while (i) *p++ = d[--i];
+    return p;
+}
+
+/* The 256-color palette's entry nearest c, from the 6x6x6 cube (16-231)
+ * or the gray ramp (232-255), and its color in out */
+static int palette_nearest(const unsigned char c[3], unsigned char out[3]) {
+    static const unsigned char cube[6] = { 0, 95, 135, 175, 215, 255 };
+    int q[3], d_cube = 0, d_gray = 0;
+    for (int i = 0; i < 3; i++) {
+        q[i] = c[i] < 48 ? 0 : c[i] < 115 ? 1 : (c[i] - 35) / 40;
+        d_cube += (c[i] - cube[q[i]]) * (c[i] - cube[q[i]]);
+    }
+    int g = ((c[0] + c[1] + c[2]) / 3 - 3) / 10;
+    g = g < 0 ? 0 : g > 23 ? 23 : g;
+    for (int i = 0; i < 3; i++) d_gray += (c[i] - 8 - 10 * g) * (c[i] - 8 - 10 * g);
+    if (d_gray < d_cube) {
+        memset(out, 8 + 10 * g, 3);
+        return 232 + g;
+    }
+    for (int i = 0; i < 3; i++) out[i] = cube[q[i]];
+    return 16 + 36 * q[0] + 6 * q[1] + q[2];
+}
+
+/* The shaded modes' colors, exact and as the palette shows them */
+static void shade_init(struct icosa *v) {
+    for (int m = 0; m < SHADE_MODES; m++) {
+        int kind = m / SHADES, l = m % SHADES;
+        unsigned char *c = v->shade_rgb[1][m];
+        for (int i = 0; i < 3; i++) {
+            int sky = rgb_color[0][i], own = rgb_color[kind + 1][i];
+            c[i] = (unsigned char)(kind < 2 ? sky + (own - sky) * l / (SHADES - 1)
+                                            : own * (SHADES - 1 + 3 * l) / (4 * (SHADES - 1)));
+        }
+        v->shade_pal[m] = (unsigned char)palette_nearest(c, v->shade_rgb[0][m]);
+    }
+}
+
+/* Switch the terminal to a mode */
+static char *put_sgr(const struct icosa *v, char *p, int mode) {
+    if (mode < MODES) return put_str(p, mode_sgr[mode]);
+    int m = mode - MODE_FOG;
+    p = put_str(p, mode >= MODE_EDGE ? "\033[0;38;" : "\033[48;");
+    if (v->flags & ICOSA_TRUECOLOR) {
+        *p++ = '2';
+        for (int i = 0; i < 3; i++) {
+            *p++ = ';';
+            p = put_uint(p, v->shade_rgb[1][m][i]);
+        }
+    } else {
+        p = put_str(p, "5;");
+        p = put_uint(p, v->shade_pal[m]);
+    }
+    *p++ = 'm';
+    return p;
+}
+
+static const char *mode_glyph(int mode) {
+    return mode < MODE_HALF || mode >= MODE_GRAY ? " " : mode < 7 ? HALF_LOWER : HALF_UPPER;
+}
+
+/* Frames are bracketed as a synchronized update (DEC mode 2026), so a
+ * frame streamed out in several chunks still appears all at once. */
+#define SYNC_BEGIN "\033[?2026h"
+#define SYNC_END "\033[?2026l"
+#define ENC_FORMAT 2 /* bump whenever drawing or encoding changes */
+
+/* Diff frames move the cursor with CUP; RLE repeats a cell with REP and
+ * erases a blank run to the right edge with ECH. Unchanged gaps of up to
+ * DIFF_BRIDGE cells are rewritten rather than jumped, which is never
+ * longer than the CUP it saves. */
+#define CUP_MAX sizeof("\033[65535;65535H")
+#define DIFF_BRIDGE 3
+
+/* Worst-case encoding of one row, from the escapes the encoder can emit:
+ * every cell switches mode, floor cells are a space, object cells the
+ * longest glyph (with ICOSA_SHADE, in the longest color), and the row
+ * ends with a reset and a newline. Repeats and erases only ever shorten
+ * a run.
+ * A diff row writes a CUP before every run, and a reset if it ends the
+ * frame. The first CUP is added on top. Every later run follows a gap
+ * of more than DIFF_BRIDGE cells that aren't written, yet are budgeted
+ * for above, so its CUP is paid for as long as DIFF_BRIDGE + 1 cells
+ * come to CUP_MAX; a cell is counted at no less than that share. */
+static size_t row_bound(int cols) {
+    size_t cell = 0;
+    for (int m = 0; m < MODES; m++) {
+        if (!mode_sgr[m]) continue;
+        size_t n = strlen(mode_sgr[m]) + (m == 3 ? GLYPH_MAX : strlen(mode_glyph(m)));
+        if (n > cell) cell = n;
+    }
+    if (SHADE_SGR_MAX + GLYPH_MAX > cell) cell = SHADE_SGR_MAX + GLYPH_MAX;
+    if (cell * (DIFF_BRIDGE + 1) < CUP_MAX) cell = (CUP_MAX + DIFF_BRIDGE) / (DIFF_BRIDGE + 1);
+    return (size_t)cols * cell + CUP_MAX + 2 * strlen(mode_sgr[0]) + 1;
+}
+
+size_t icosa_frame_bound(int cols, int rows) {
+    return (size_t)rows * row_bound(cols) + sizeof(SYNC_BEGIN "\033[H" SYNC_END) - 1;
+}
+
+size_t icosa_chunk_min(int cols) { return icosa_frame_bound(cols, 1); }
+
+static uint64_t fnv1a(uint64_t h, const void *p, size_t n) {
+    const unsigned char *s = p;
+    while (n--) h = (h ^ *s++) * 0x100000001b3ULL;
+    return h;
+}
+
+uint64_t icosa_version(void) {
+    static const int format[2] = { ENC_FORMAT, ICOSA_GLYPHS };
+    uint64_t h = fnv1a(0xcbf29ce484222325ULL, format, sizeof(format));
+    for (int m = 0; m < MODES; m++)
+        if (mode_sgr[m]) h = fnv1a(h, mode_sgr[m], strlen(mode_sgr[m]));
+    h = fnv1a(h, SYNC_BEGIN SYNC_END, sizeof(SYNC_BEGIN SYNC_END));
+    return fnv1a(h, spin, sizeof(spin));
+}
+
+#define ARENA_ALIGN 64 /* cache line, and wide enough for any SIMD load */
+
+static size_t align_up(size_t n, size_t a) { return (n + a - 1) & ~(a - 1); }
+
+/* One row of floor, sampled t of the way from the horizon to the bottom */
+static void floor_row(unsigned char *out, int cw, float t) {
+    float z = 1.0f / t; /* perspective depth */
+    int iz = (int)floorf(z * 4.0f);
+    for (int col = 0; col < cw; col++) {
+        float x = ((float)col / (float)cw - 0.5f) * z * 8.0f;
+        int ix = (int)floorf(x);
+        out[col] = (unsigned char)(((ix + iz) & 1) ? 1 : 2);
+    }
+}
+
+/* The floor sampled once per cell, at the top of the cell */
+static void compute_floor(struct icosa *v) {
+    int cw = v->cw, ch = v->ch;
+    int horizon = v->horizon = ch * 55 / 100;
+    memset(v->floor_map, 0, (size_t)(horizon + 1) * cw);
+
+    float floor_h = (float)(ch - horizon);
+    for (int row = horizon + 1; row < ch; row++)
+        floor_row(v->floor_map + (size_t)row * cw, cw, (float)(row - horizon) / floor_h);
+}
+
+/* ICOSA_FINE_FLOOR: the floor sampled again halfway down each cell; the
+ * top half is compute_floor()'s sample. */
+static void compute_fine(struct icosa *v) {
+    int cw = v->cw, ch = v->ch, horizon = v->horizon;
+    memset(v->floor_mode, 0, (size_t)horizon * cw);
+
+    float floor_h = (float)(ch - horizon);
+    for (int row = horizon; row < ch; row++) {
+        const unsigned char *top = v->floor_map + (size_t)row * cw;
+        unsigned char *mode = v->floor_mode + (size_t)row * cw;
+        floor_row(mode, cw, ((float)(row - horizon) + 0.5f) / floor_h);
+        for (int col = 0; col < cw; col++)
+            if (mode[col] != top[col]) mode[col] = (unsigned char)(4 + top[col] * 3 + mode[col]);
+    }
+}
+
+/* ICOSA_SMOOTH_FLOOR: each floor cell is the share of AA_K x AA_K
+ * subsamples that land on light squares, as the nearest gray between the
+ * dark and light colors; cells wholly one color keep their mode. The
+ * subsamples of VEC / AA_K neighboring cells are evaluated together, a
+ * lane each, with floor() done by truncating and correcting negatives.
+ * It takes under half a millisecond at 400x120 on one core (make
+ * bench BENCH=compute_smooth), so it isn't worth threading. */
+#define AA_K 4
+#ifdef __AVX__
+#define VEC 8 /* floats in a vector register; a multiple of AA_K */
+#else
+#define VEC 4
+#endif
+typedef float vfloat __attribute__((vector_size(VEC * sizeof(float))));
+typedef int32_t vint __attribute__((vector_size(VEC * sizeof(int32_t))));
+
+static void compute_smooth(struct icosa *v) {
+    int cw = v->cw, ch = v->ch, horizon = v->horizon, n = cw * AA_K;
+    memset(v->floor_aa, 0, (size_t)(horizon + 1) * cw);
+
+    vfloat lane;
+    for (int i = 0; i < VEC; i++) lane[i] = (float)i;
+    float floor_h = (float)(ch - horizon);
+    for (int row = horizon + 1; row < ch; row++) {
+        /* Subsample s of a subrow is at x = s * a + b, as compute_floor()
+         * has it for cells */
+        float a[AA_K], b[AA_K];
+        int32_t iz[AA_K];
+        for (int sy = 0; sy < AA_K; sy++) {
+            float z = floor_h / ((float)(row - horizon) + ((float)sy + 0.5f) / AA_K);
+            iz[sy] = (int32_t)floorf(z * 4.0f);
+            a[sy] = z * 8.0f / (float)n;
+            b[sy] = (0.5f / (float)n - 0.5f) * z * 8.0f;
+        }
+        unsigned char *out = v->floor_aa + (size_t)row * cw;
+        for (int col = 0; col < cw; col += VEC / AA_K) {
+            vfloat s = (float)(col * AA_K) + lane;
+            vint hits = {0};
+            for (int sy = 0; sy < AA_K; sy++) {
+                vfloat x = s * a[sy] + b[sy];
+                vint ix = __builtin_convertvector(x, vint);
+                ix += __builtin_convertvector(ix, vfloat) > x; /* true is -1 */
+                hits += ((ix + iz[sy]) & 1) ^ 1;
+            }
+            for (int c = 0; c < VEC / AA_K && col + c < cw; c++) {
+                int sum = 0;
+                for (int i = 0; i < AA_K; i++) sum += hits[c * AA_K + i];
+                int j = (sum * 16 + AA_K * AA_K / 2) / (AA_K * AA_K);
+                out[col + c] = (unsigned char)(j == 0 ? 1 : j == 16 ? 2 : MODE_GRAY + j);
+            }
+        }
+    }
+}
+
+/* ICOSA_SHADE: whether two shaded modes are within v->merge */
+static int shades_near(const struct icosa *v, int a, int b) {
+    const unsigned char (*rgb)[3] = v->shade_rgb[v->flags & ICOSA_TRUECOLOR ? 1 : 0];
+    const unsigned char *x = rgb[a - MODE_FOG], *y = rgb[b - MODE_FOG];
+    int merge = (int)(v->merge < 255 ? v->merge : 255);
+    return abs(x[0] - y[0]) <= merge && abs(x[1] - y[1]) <= merge && abs(x[2] - y[2]) <= merge;
+}
+
+/* ICOSA_SHADE: the floor's level at depth z, all of its color at the
+ * near edge (z = 1) and thinning into the sky toward the horizon. Along
+ * each row, a cell within v->merge of the color starting its run takes
+ * that color, so the run needs one SGR; the object is left out, so this
+ * is done once per size, and again if the colors change. */
+#define FOG_DENSITY 0.2f
+
+static void compute_fog(struct icosa *v) {
+    int cw = v->cw, ch = v->ch, horizon = v->horizon;
+    memset(v->floor_fog, 0, (size_t)(horizon + 1) * cw);
+    for (int row = horizon + 1; row < ch; row++) {
+        float z = (float)(ch - horizon) / ((float)(row - horizon) + 0.5f);
+        int level = (int)(expf((1.0f - z) * FOG_DENSITY) * (SHADES - 1) + 0.5f);
+        const unsigned char *map = v->floor_map + (size_t)row * cw;
+        unsigned char *fog = v->floor_fog + (size_t)row * cw;
+        int run = 0;
+        for (int col = 0; col < cw; col++) {
+            int m = MODE_FOG + (map[col] - 1) * SHADES + level;
+            if (col && m != run && shades_near(v, run, m)) m = run;
+            fog[col] = (unsigned char)(run = m);
+        }
+    }
+}
+
+/* Make a flag's table at least n bytes, as the arena grows: the first
+ * allocation is exact and later ones at least double. What it held
+ * isn't kept. Returns the buffer, or NULL leaving buf as it was. */
+static void *buf_grow(void *buf, size_t *cap, size_t n) {
+    if (n <= *cap) return buf;
+    size_t c = *cap * 2 > n ? *cap * 2 : n;
+    void *p = malloc(c);
+    if (!p) return NULL;
+    free(buf);
+    *cap = c;
+    return p;
+}
+
+/* Encode every row of the fine floor once, as the encoder would with no
+ * object in the way, noting where each cell starts. A run of floor is
+ * then one copy out of this, plus the SGR if it starts mid-run. */
+static int compute_runs(struct icosa *v) {
+    int cw = v->cw, ch = v->ch;
+    size_t need = 0;
+    for (int y = 0; y < ch; y++) {
+        const unsigned char *mode = v->floor_mode + (size_t)y * cw;
+        for (int x = 0; x < cw; x++) {
+            if (x == 0 || mode[x] != mode[x - 1]) need += strlen(mode_sgr[mode[x]]);
+            need += strlen(mode_glyph(mode[x]));
+        }
+    }
+    size_t offs = (size_t)ch * (cw + 1);
+    if (need > UINT32_MAX) return -1;
+    char *r = buf_grow(v->runs, &v->runs_cap, need);
+    if (!r) return -1;
+    v->runs = r;
+    uint32_t *o = buf_grow(v->run_off, &v->run_off_cap, offs * sizeof(*o));
+    if (!o) return -1;
+    v->run_off = o;
+
+    char *p = v->runs;
+    for (int y = 0; y < ch; y++) {
+        const unsigned char *mode = v->floor_mode + (size_t)y * cw;
+        uint32_t *off = v->run_off + (size_t)y * (cw + 1);
+        for (int x = 0; x < cw; x++) {
+            off[x] = (uint32_t)(p - v->runs);
+            if (x == 0 || mode[x] != mode[x - 1]) p = put_str(p, mode_sgr[mode[x]]);
+            p = put_str(p, mode_glyph(mode[x]));
+        }
+        off[cw] = (uint32_t)(p - v->runs);
+    }
+    return 0;
+}
+
+/* The tables a flag needs are made when a frame is first rasterized with
+ * it at this size, so a view pays nothing for floors it doesn't draw. A
+ * flag whose tables can't be made draws as if off, and they're tried
+ * again next frame. */
+static void update_tables(struct icosa *v) {
+    unsigned need = v->flags & v->stale;
+    size_t cells = (size_t)v->cw * v->ch;
+    unsigned char *t;
+    if ((need & ICOSA_FINE_FLOOR) &&
+        (t = buf_grow(v->floor_mode, &v->floor_mode_cap, cells))) {
+        v->floor_mode = t;
+        compute_fine(v);
+        if (compute_runs(v) == 0) v->stale &= ~ICOSA_FINE_FLOOR;
+    }
+    if ((need & ICOSA_SMOOTH_FLOOR) &&
+        (t = buf_grow(v->floor_aa, &v->floor_aa_cap, cells))) {
+        v->floor_aa = t;
+        compute_smooth(v);
+        v->stale &= ~ICOSA_SMOOTH_FLOOR;
+    }
+    if ((need & ICOSA_SHADE) && (t = buf_grow(v->tones, &v->tones_cap, 3 * cells))) {
+        v->floor_fog = v->tones = t;
+        v->tone = v->tones + cells;
+        v->prev_tone = v->tones + 2 * cells;
+        compute_fog(v);
+        v->stale &= ~ICOSA_SHADE;
+    }
+    if (need & ~v->stale) v->fresh = 0; /* the terminal saw them off */
+}
+
+/* The flags as drawn: those whose tables are made */
+static unsigned drawn(const struct icosa *v) { return v->flags & ~v->stale; }
+
+/* Make the arena at least `need` bytes. The first mapping is exact; later
+ * growth at least doubles, so a drag-resize settles after a few remaps.
+ * Pages are prefaulted up front so the first frame doesn't take faults. */
+static int arena_reserve(struct icosa *v, size_t need) {
+    if (need <= v->arena_cap) return 0;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t n = align_up(v->arena_cap * 2 > need ? v->arena_cap * 2 : need, page);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    unsigned char *p = mmap(NULL, n, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) return -1;
+#ifndef MAP_POPULATE
+    for (size_t i = 0; i < n; i += page) p[i] = 0;
+#endif
+    if (v->arena) munmap(v->arena, v->arena_cap);
+    v->arena = p;
+    v->arena_cap = n;
+    return 0;
+}
+
+/* Adopt a new size: buffers, floor, and physics scaling. Nothing in the
+ * arena survives a resize — fb is cleared every frame and the floor is
+ * recomputed — so remapping never copies. The flags' tables are made
+ * by the next icosa_rasterize(). */
+int icosa_resize(struct icosa *v, int cols, int rows) {
+    if (cols < ICOSA_MIN_COLS || rows < ICOSA_MIN_ROWS) return -1;
+    if (cols == v->cw && rows == v->ch) return 0;
+    size_t cells = align_up((size_t)cols * rows, ARENA_ALIGN);
+    if (arena_reserve(v, 3 * cells) < 0) return -1;
+    v->fb = v->arena;
+    v->floor_map = v->arena + cells;
+    v->prev = v->arena + 2 * cells;
+    v->fresh = 0;
+    v->stale = ICOSA_FINE_FLOOR | ICOSA_SMOOTH_FLOOR | ICOSA_SHADE;
+
+    v->cw = cols;
+    v->ch = rows;
+    v->pw = cols * CELL_W;
+    v->ph = rows * CELL_H;
+    compute_floor(v);
+    fb_clear(v);
+    v->row = rows; /* nothing rasterized at this size yet */
+
+    v->scale = fminf((float)v->pw / ASPECT, (float)v->ph) * 0.45f;
+    v->center_x = (float)v->pw / 2.0f;
+    v->floor_py = (float)(v->horizon * CELL_H); /* horizon in dots */
+    v->max_bounce = v->floor_py * 0.55f;   /* max bounce height in pixels */
+    return 0;
+}
+
+/* Fill in the float view of the simulation. Angles come straight from
+ * the frame count, wrapped in double precision, so they never drift. */
+static void derive(struct icosa_state *s) {
+    const double two_pi = 6.283185307179586;
+    s->pos = (float)s->ipos / HEIGHT;
+    s->vel = (float)s->ivel / HEIGHT;
+    s->squash = (float)s->isquash / SQUASH_ONE;
+    for (int i = 0; i < 3; i++)
+        s->rot[i] = (float)fmod((double)spin[i] * s->frame, two_pi);
+}
+
+void icosa_state_init(struct icosa_state *s) {
+    memset(s, 0, sizeof(*s));
+    s->ipos = HEIGHT; /* start at top of bounce */
+    derive(s);
+}
+
+struct icosa *icosa_create(int cols, int rows, const struct icosa_opts *opts) {
+    struct icosa *v = calloc(1, sizeof(*v));
+    if (!v) return NULL;
+    if (opts) {
+        v->flags = opts->flags;
+        v->merge = opts->merge;
+    }
+    shade_init(v);
+    if (icosa_resize(v, cols, rows) < 0) {
+        icosa_destroy(v);
+        return NULL;
+    }
+    icosa_state_init(&v->state);
+    return v;
+}
+
+void icosa_destroy(struct icosa *v) {
+    if (!v) return;
+    if (v->arena) munmap(v->arena, v->arena_cap);
+    free(v->floor_mode);
+    free(v->floor_aa);
+    free(v->tones);
+    free(v->runs);
+    free(v->run_off);
+    free(v->scratch);
+    free(v);
+}
+
+void icosa_get_size(const struct icosa *v, int *cols, int *rows) {
+    if (cols) *cols = v->cw;
+    if (rows) *rows = v->ch;
+}
+
+struct icosa_state *icosa_state(struct icosa *v) { return &v->state; }
+
+void icosa_spin(float out[3]) { memcpy(out, spin, sizeof(spin)); }
+
+static int32_t squash_decay(int32_t sq, uint32_t frames) {
+    for (; frames && sq; frames--) sq = sq * 7 / 10;
+    return sq;
+}
+
+/* What an impact at speed v (downwards) leaves behind: the squash, and
+ * the speed it bounces back up with. Returns 1 if the bounce has run out
+ * of energy and restarts instead. */
+static int impact(int32_t v, int32_t *squash, int32_t *out) {
+    int64_t sq = (int64_t)v * (SQUASH_ONE / 2) / RESTART_VEL;
+    *squash = (int32_t)(sq < SQUASH_ONE / 2 ? sq : SQUASH_ONE / 2);
+    *out = (int32_t)((int64_t)v * 82 / 100);
+    if (*out >= 8 * GRAV) return 0;
+    *out = RESTART_VEL;
+    return 1;
+}
+
+int icosa_tick(struct icosa_state *s) {
+    int restart = 0;
+    s->ivel -= GRAV;
+    s->ipos += s->ivel;
+    if (s->ipos <= 0) {
+        s->ipos = 0;
+        restart = impact(-s->ivel, &s->isquash, &s->ivel);
+    }
+    s->isquash = squash_decay(s->isquash, 1);
+    s->frame++;
+    derive(s);
+    return restart;
+}
+
+/* Height k frames into a flight that left height p at speed v */
+static int64_t flight_pos(int64_t p, int64_t v, int64_t k) {
+    return p + k * v - GRAV * k * (k + 1) / 2;
+}
+
+/* Frames from leaving p at speed v until the step that reaches the floor:
+ * the quadratic's root, nudged onto the exact integer answer */
+static uint32_t flight_frames(int64_t p, int64_t v) {
+    double b = (double)v - GRAV / 2.0;
+    int64_t k = (int64_t)((b + sqrt(b * b + 2.0 * GRAV * (double)p)) / GRAV);
+    if (k < 1) k = 1;
+    while (k > 1 && flight_pos(p, v, k - 1) <= 0) k--;
+    while (flight_pos(p, v, k) > 0) k++;
+    return (uint32_t)k;
+}
+
+/* The bounce repeats with period len from frame start, except for the
+ * frame counter and the angles */
+static void bounce_cycle(uint32_t *r1, uint32_t *len) {
+    int64_t p = HEIGHT, v = 0;
+    uint32_t f = 0, restarts = 0;
+    int32_t sq;
+    *r1 = 0;
+    for (;;) {
+        uint32_t k = flight_frames(p, v);
+        int32_t out;
+        f += k;
+        int r = impact((int32_t)(GRAV * (int64_t)k - v), &sq, &out);
+        p = 0;
+        v = out;
+        if (!r) continue;
+        if (restarts++) break;
+        *r1 = f;
+    }
+    *len = f - *r1;
+}
+
+/* Segment walk: flights between impacts are solved in closed form, and
+ * past the second restart the frame is folded back by whole periods, so
+ * the cost is a few dozen segments whatever the frame. */
+void icosa_state_at(struct icosa_state *s, uint32_t frame) {
+    uint32_t r1, len;
+    bounce_cycle(&r1, &len);
+    uint32_t n = frame >= r1 + len ? r1 + len + (frame - r1 - len) % len : frame;
+
+    int64_t p = HEIGHT, v = 0;
+    int32_t sq = 0;
+    uint32_t f0 = 0;
+    for (;;) {
+        uint32_t k = flight_frames(p, v);
+        if (n < f0 + k) break;
+        int32_t out;
+        f0 += k;
+        impact((int32_t)(GRAV * (int64_t)k - v), &sq, &out);
+        sq = squash_decay(sq, 1);
+        p = 0;
+        v = out;
+    }
+    uint32_t j = n - f0;
+    s->ipos = (int32_t)flight_pos(p, v, j);
+    s->ivel = (int32_t)(v - (int64_t)j * GRAV);
+    s->isquash = squash_decay(sq, j);
+    s->frame = frame;
+    derive(s);
+}
+
+void icosa_cycle(uint32_t *start, uint32_t *len) {
+    uint32_t r1;
+    bounce_cycle(&r1, len);
+    /* The motion repeats from the second restart on; the squash left by
+     * the first may differ, so walk back while the two still agree */
+    uint32_t f = r1 + *len;
+    struct icosa_state a, b;
+    for (; f > 0; f--) {
+        icosa_state_at(&a, f - 1);
+        icosa_state_at(&b, f - 1 + *len);
+        if (a.ipos != b.ipos || a.ivel != b.ivel || a.isquash != b.isquash) break;
+    }
+    *start = f;
+}
+
+void icosa_seek(struct icosa *v, double t) {
+    icosa_state_at(&v->state, t > 0 ? (uint32_t)(t * ICOSA_FPS) : 0);
+    v->acc = 0;
+}
+
+int icosa_step(struct icosa *v, double dt) {
+    const double frame = 1.0 / ICOSA_FPS;
+    if (dt > 0) v->acc += dt;
+    if (v->acc > 1.0) v->acc = 1.0; /* fell far behind: don't catch up */
+    int n = 0;
+    for (; v->acc >= frame; v->acc -= frame, n++)
+        icosa_tick(&v->state);
+    return n;
+}
+
+/* Project the vertices for state s into a view whose object is centered
+ * at center_x, sitting on floor_py when at rest, in pixels of that view,
+ * which are aspect times as tall as they are wide. depth, if not NULL,
+ * gets each vertex's depth: positive is behind the object's center. */
+static void project(const struct icosa_state *s, float center_x, float floor_py,
+                    float max_bounce, float scale, float aspect,
+                    float proj[NVERTS][2], float *depth) {
+    float yscale = 1.0f - s->squash;
+    float xzscale = 1.0f + s->squash * 0.5f;
+
+    /* Object center: centered horizontally, bounces vertically */
+    float obj_cx = center_x;
+    float obj_cy = floor_py - s->pos * max_bounce - scale * 0.2f;
+
+    float s1 = sinf(s->rot[0]), c1 = cosf(s->rot[0]);
+    float s2 = sinf(s->rot[1]), c2 = cosf(s->rot[1]);
+    float s3 = sinf(s->rot[2]), c3 = cosf(s->rot[2]);
+
+    for (int i = 0; i < NVERTS; i++) {
+        float x = base_verts[i][0];
+        float y = base_verts[i][1];
+        float z = base_verts[i][2];
+
+        /* Rotate */
+        float y1 = y * c1 - z * s1;
+        float z1 = y * s1 + z * c1;
+        float x2 = x * c2 + z1 * s2;
+        float z2 = -x * s2 + z1 * c2;
+        float x3 = x2 * c3 - y1 * s3;
+        float y3 = x2 * s3 + y1 * c3;
+
+        /* Squash/stretch in screen space (vertical squash on impact) */
+        x3 *= xzscale;
+        y3 *= yscale;
+
+        /* Perspective */
+        float d = 5.0f + z2 * 0.3f;
+        proj[i][0] = obj_cx + (x3 / d) * scale * aspect;
+        proj[i][1] = obj_cy + (y3 / d) * scale;
+        if (depth) depth[i] = z2;
+    }
+}
+
+/* A frame rasterized but not yet started goes out in full too */
+void icosa_invalidate(struct icosa *v) {
+    v->fresh = 0;
+    if (v->row == 0 && !v->opened) v->full = 1;
+}
+
+void icosa_set_flags(struct icosa *v, unsigned flags) {
+    /* prev wasn't kept, or unchanged dots would now look different */
+    if ((flags ^ v->flags) &
+        (ICOSA_DIFF | ICOSA_ASCII | ICOSA_NO_FLOOR | ICOSA_FINE_FLOOR | ICOSA_SMOOTH_FLOOR |
+         ICOSA_SHADE | ICOSA_TRUECOLOR))
+        v->fresh = 0;
+    if ((flags ^ v->flags) & ICOSA_TRUECOLOR) v->stale |= ICOSA_SHADE; /* fog merged by color */
+    v->flags = flags;
+}
+
+unsigned icosa_get_flags(const struct icosa *v) { return v->flags; }
+
+/* ICOSA_SHADE: an edge's level at depth z, in 16.16 fixed point, from
+ * the nearest a vertex can be to the furthest */
+#define EDGE_DEPTH 1.75f /* sqrt(3), a cube corner, and a little */
+
+static int32_t edge_level(float z) {
+    float b = (EDGE_DEPTH - z) / (2.0f * EDGE_DEPTH);
+    b = b < 0.0f ? 0.0f : b > 1.0f ? 1.0f : b;
+    return (int32_t)(b * (SHADES - 1) * 65536.0f);
+}
+
+/* ICOSA_SHADE: the tones drawn become modes, the floor's coming from
+ * the map in use. Along each run of object cells, one within v->merge of
+ * the color starting the run takes that color, as compute_fog() does for
+ * the floor. */
+static void shade_cells(struct icosa *v) {
+    int cw = v->cw;
+    unsigned flags = drawn(v);
+    const unsigned char *floor = flags & ICOSA_NO_FLOOR ? NULL
+                                 : flags & ICOSA_FINE_FLOOR ? v->floor_mode
+                                 : flags & ICOSA_SMOOTH_FLOOR ? v->floor_aa
+                                 : v->floor_fog;
+    for (int y = 0; y < v->ch; y++) {
+        size_t i = (size_t)y * cw;
+        unsigned char *tone = v->tone + i;
+        const unsigned char *fb = v->fb + i;
+        for (int x = 0; x < cw;) {
+            int end = x + 1;
+            if (!fb[x]) {
+                while (end < cw && !fb[end]) end++;
+                if (floor) memcpy(tone + x, floor + i + x, (size_t)(end - x));
+                else memset(tone + x, 0, (size_t)(end - x));
+                x = end;
+                continue;
+            }
+            int run = MODE_EDGE + tone[x];
+            tone[x] = (unsigned char)run;
+            for (x++; x < cw && fb[x]; x++) {
+                int m = MODE_EDGE + tone[x];
+                if (m != run && shades_near(v, run, m)) m = run;
+                tone[x] = (unsigned char)(run = m);
+            }
+        }
+    }
+}
+
+void icosa_rasterize(struct icosa *v) {
+    update_tables(v);
+    int lit = drawn(v) & ICOSA_SHADE, half = v->flags & ICOSA_HALF_RES;
+    fb_clear(v);
+    if (lit) memset(v->tone, 0, (size_t)v->cw * v->ch);
+    v->row = 0;
+    v->opened = 0;
+    v->full = !(v->flags & ICOSA_DIFF) || !v->fresh;
+
+    /* At half resolution the whole view is projected at half size */
+    float k = half ? 0.5f : 1.0f;
+    float proj[NVERTS][2], depth[NVERTS];
+    project(&v->state, v->center_x * k, v->floor_py * k, v->max_bounce * k,
+            v->scale * k, ASPECT, proj, depth);
+    for (int i = 0; i < NEDGES; i++) {
+        int a = edges[i][0], b = edges[i][1];
+        if ((v->flags & ICOSA_NO_BACK) && depth[a] > 0 && depth[b] > 0) continue;
+        int x0 = (int)proj[a][0], y0 = (int)proj[a][1], x1 = (int)proj[b][0], y1 = (int)proj[b][1];
+        if (lit)
+            (half ? draw_line_half_lit : draw_line_lit)(v, x0, y0, x1, y1,
+                                                        edge_level(depth[a]), edge_level(depth[b]));
+        else
+            (half ? draw_line_half : draw_line)(v, x0, y0, x1, y1);
+    }
+    if (lit) shade_cells(v);
+}
+
+/* Bresenham with a square brush of side `pen`, clipped to the image */
+static void rgb_line(unsigned char *rgb, int w, int h, int pen,
+                     int x0, int y0, int x1, int y1) {
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    for (;;) {
+        for (int y = y0 - pen / 2; y < y0 - pen / 2 + pen; y++) {
+            if (y < 0 || y >= h) continue;
+            for (int x = x0 - pen / 2; x < x0 - pen / 2 + pen; x++)
+                if (x >= 0 && x < w) memcpy(rgb + ((size_t)y * w + x) * 3, rgb_color[3], 3);
+        }
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x0 += sx; }
+        if (e2 <= dx) { err += dx; y0 += sy; }
+    }
+}
+
+/* The same scene with square pixels: the floor is compute_floor()'s
+ * projection sampled at every pixel instead of every cell, and edges are
+ * drawn with a pen that scales with the image. */
+void icosa_render_rgb(const struct icosa_state *s, int w, int h, unsigned char *rgb) {
+    int horizon = h * 55 / 100;
+    float floor_h = (float)(h - horizon);
+    for (int y = 0; y < h; y++) {
+        unsigned char *out = rgb + (size_t)y * w * 3;
+        if (y <= horizon) {
+            memset(out, 0, (size_t)w * 3);
+            continue;
+        }
+        float z = floor_h / (float)(y - horizon); /* perspective depth */
+        int iz = (int)floorf(z * 4.0f);
+        for (int x = 0; x < w; x++) {
+            int ix = (int)floorf(((float)x / (float)w - 0.5f) * z * 8.0f);
+            memcpy(out + x * 3, rgb_color[((ix + iz) & 1) ? 1 : 2], 3);
+        }
+    }
+
+    float proj[NVERTS][2];
+    float floor_py = (float)horizon;
+    project(s, (float)w / 2.0f, floor_py, floor_py * 0.55f,
+            fminf((float)w, (float)h) * 0.45f, 1.0f, proj, NULL);
+    int pen = h / 360 > 1 ? h / 360 : 1;
+    for (int i = 0; i < NEDGES; i++)
+        rgb_line(rgb, w, h, pen, (int)proj[edges[i][0]][0], (int)proj[edges[i][0]][1],
+                 (int)proj[edges[i][1]][0], (int)proj[edges[i][1]][1]);
+}
+
+void icosa_cells(const struct icosa *v, const unsigned char **dots,
+                 const unsigned char **floor) {
+    if (dots) *dots = v->fb;
+    if (floor) *floor = v->floor_map;
+}
+
+int icosa_glyphs(void) { return ICOSA_GLYPHS; }
+
+void icosa_cell_dots(int *w, int *h) {
+    if (w) *w = CELL_W;
+    if (h) *h = CELL_H;
+}
+
+unsigned icosa_dot_bit(int x, int y) {
+#if ICOSA_GLYPHS == ICOSA_GLYPHS_BRAILLE
+    return braille_bits[x & 1][y & 3];
+#else
+    return 1u << (y * CELL_W + x);
+#endif
+}
+
+static int digits(unsigned n) {
+    int i = 1;
+    while (n >= 10) n /= 10, i++;
+    return i;
+}
+
+/* ICOSA_ASCII: the character nearest each dot pattern, by which
+ * quadrants of the cell have dots (bit 0 top left, 1 top right, 2 bottom
+ * left, 3 bottom right) */
+static const char ascii_quad[16] = " ''-.|/+.\\|+_++#";
+
+static char ascii_glyph(unsigned char d) {
+#if ICOSA_GLYPHS == ICOSA_GLYPHS_BRAILLE
+    int q = (d & 0x03 ? 1 : 0) | (d & 0x18 ? 2 : 0) | (d & 0x44 ? 4 : 0) | (d & 0xa0 ? 8 : 0);
+#else
+    int q = 0;
+    for (int i = 0; i < CELL_W * CELL_H; i++)
+        if (d >> i & 1)
+            q |= (CELL_W == 1 ? 3 : 1 << i % CELL_W * 2 / CELL_W) << i / CELL_W * 2 / CELL_H * 2;
+#endif
+    return ascii_quad[q];
+}
+
+/* A cell's glyph in UTF-8 */
+static char *put_glyph(char *p, unsigned char d) {
+#if ICOSA_GLYPHS == ICOSA_GLYPHS_ASCII
+    *p++ = ascii_quad[d];
+#else
+#if ICOSA_GLYPHS == ICOSA_GLYPHS_BRAILLE
+    unsigned int cp = 0x2800 + d;
+#else
+    unsigned int cp = glyph_cp[d];
+    if (GLYPH_MAX == 4 && cp > 0xFFFF) {
+        *p++ = (char)(0xF0 | (cp >> 18));
+        *p++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+    } else
+#endif
+        *p++ = (char)(0xE0 | (cp >> 12));
+    *p++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+    *p++ = (char)(0x80 | (cp & 0x3F));
+#endif
+    return p;
+}
+
+/* ICOSA_FINE_FLOOR without ICOSA_RLE: floor cells x0..x1-1 of row y,
+ * copied out of the encoded rows */
+static char *put_floor(const struct icosa *v, int y, int x0, int x1, char *p, int *sgr) {
+    const unsigned char *mode = v->floor_mode + (size_t)y * v->cw;
+    const uint32_t *off = v->run_off + (size_t)y * (v->cw + 1);
+    size_t from = off[x0];
+    if (x0 == 0 || mode[x0] != mode[x0 - 1]) from += strlen(mode_sgr[mode[x0]]);
+    if (mode[x0] != *sgr) p = put_str(p, mode_sgr[mode[x0]]);
+    memcpy(p, v->runs + from, off[x1] - from);
+    *sgr = mode[x1 - 1];
+    return p + (off[x1] - from);
+}
+
+/* Cells x0..x1-1 of row y, switching SGR from *sgr as needed. With
+ * ICOSA_RLE a run is sent once and repeated with REP when that's shorter,
+ * and a blank run reaching the right edge is erased with ECH instead,
+ * which leaves the cursor where the run began. */
+static char *put_cells(const struct icosa *v, int y, int x0, int x1, char *p, int *sgr) {
+    const unsigned char *fb = v->fb + (size_t)y * v->cw;
+    int rle = v->flags & ICOSA_RLE, ascii = v->flags & ICOSA_ASCII;
+    int nofloor = v->flags & ICOSA_NO_FLOOR, fine = drawn(v) & ICOSA_FINE_FLOOR;
+    const unsigned char *floor_map = (fine ? v->floor_mode
+                                      : drawn(v) & ICOSA_SMOOTH_FLOOR ? v->floor_aa
+                                      : v->floor_map) + (size_t)y * v->cw;
+    const unsigned char *tone = drawn(v) & ICOSA_SHADE ? v->tone + (size_t)y * v->cw : NULL;
+    for (int x = x0; x < x1;) {
+        if (fine && !rle && !nofloor && !fb[x]) {
+            int end = x + 1;
+            while (end < x1 && !fb[end]) end++;
+            p = put_floor(v, y, x, end, p, sgr);
+            x = end;
+            continue;
+        }
+        int mode = tone ? tone[x] : fb[x] ? 3 : nofloor ? 0 : floor_map[x];
+        int run = 1;
+        if (rle)
+            while (x + run < x1 && fb[x + run] == fb[x] &&
+                   (tone ? tone[x + run] == tone[x]
+                         : fb[x] || nofloor || floor_map[x + run] == floor_map[x]))
+                run++;
+
+        if (mode != *sgr) {
+            p = put_sgr(v, p, mode);
+            *sgr = mode;
+        }
+
+        if (rle && !fb[x] && (mode < 3 || mode >= MODE_GRAY) && x + run == v->cw && run > digits((unsigned)run) + 3) {
+            p = put_str(p, "\033[");
+            p = put_uint(p, (unsigned)run);
+            *p++ = 'X';
+            break;
+        }
+        char *start = p;
+        if (fb[x] && ascii) *p++ = ascii_glyph(fb[x]);
+        else if (fb[x]) p = put_glyph(p, fb[x]);
+        else if (mode < MODE_HALF || mode >= MODE_GRAY) *p++ = ' ';
+        else p = put_str(p, mode_glyph(mode));
+        int glyph = (int)(p - start);
+        if (run > 1 && (run - 1) * glyph > digits((unsigned)run - 1) + 3) {
+            p = put_str(p, "\033[");
+            p = put_uint(p, (unsigned)run - 1);
+            *p++ = 'b';
+        } else {
+            for (int i = 1; i < run; i++) {
+                memcpy(p, p - glyph, (size_t)glyph);
+                p += glyph;
+            }
+        }
+        x += run;
+    }
+    return p;
+}
+
+static char *encode_row(const struct icosa *v, int y, char *p) {
+    int sgr = -1;
+    p = put_cells(v, y, 0, v->cw, p, &sgr);
+    p = put_str(p, mode_sgr[0]);
+    if (y < v->ch - 1) *p++ = '\n';
+    return p;
+}
+
+/* Only the cells that differ from prev, in runs addressed with CUP. The
+ * SGR state carries over from row to row. */
+static int changed(const struct icosa *v, size_t i) {
+    return v->fb[i] != v->prev[i] || ((drawn(v) & ICOSA_SHADE) && v->tone[i] != v->prev_tone[i]);
+}
+
+static char *encode_diff_row(struct icosa *v, int y, char *p) {
+    size_t row = (size_t)y * v->cw;
+    int cursor = -1; /* column the cursor is known to be at in this row */
+    for (int x = 0; x < v->cw; x++) {
+        if (!changed(v, row + x)) continue;
+        int end = x + 1;
+        for (int e = end; e < v->cw && e - end <= DIFF_BRIDGE; e++)
+            if (changed(v, row + e)) end = e + 1;
+        if (cursor != x) {
+            p = put_str(p, "\033[");
+            p = put_uint(p, (unsigned)y + 1);
+            *p++ = ';';
+            p = put_uint(p, (unsigned)x + 1);
+            *p++ = 'H';
+        }
+        p = put_cells(v, y, x, end, p, &v->sgr);
+        cursor = end;
+        x = end - 1;
+    }
+    return p;
+}
+
+size_t icosa_encode(struct icosa *v, char *buf, size_t cap) {
+    int sync = !(v->flags & ICOSA_NO_SYNC), diff = v->flags & ICOSA_DIFF;
+    int shade = drawn(v) & ICOSA_SHADE;
+    const char *head = !v->full ? (sync ? SYNC_BEGIN : "")
+                                : (sync ? SYNC_BEGIN "\033[H" : "\033[H");
+    const char *tail = sync ? SYNC_END : "";
+    size_t row = row_bound(v->cw), nhead = strlen(head), ntail = strlen(tail);
+    size_t cells = (size_t)v->cw;
+    char *p = buf;
+
+    /* The header goes out with the first row written and the trailer with
+     * the last row, so every call returns something a terminal can take
+     * as is. A diff frame with nothing changed writes nothing at all. */
+    for (; v->row < v->ch; v->row++) {
+        int y = v->row, last = y == v->ch - 1;
+        size_t need = row + (v->opened ? 0 : nhead) + (last ? ntail : 0);
+        if ((size_t)(buf + cap - p) < need) break;
+        unsigned char *fb = v->fb + (size_t)y * cells, *old = v->prev + (size_t)y * cells;
+        unsigned char *tone = shade ? v->tone + (size_t)y * cells : NULL;
+        unsigned char *old_tone = shade ? v->prev_tone + (size_t)y * cells : NULL;
+        if (v->full || memcmp(fb, old, cells) != 0 ||
+            (shade && memcmp(tone, old_tone, cells) != 0)) {
+            if (!v->opened) {
+                p = put_str(p, head);
+                v->opened = 1;
+                if (v->full) v->sgr = 0;
+            }
+            p = v->full ? encode_row(v, y, p) : encode_diff_row(v, y, p);
+            if (diff && !v->dry) memcpy(old, fb, cells);
+            if (diff && shade && !v->dry) memcpy(old_tone, tone, cells);
+        }
+        if (last && v->opened) {
+            if (v->sgr) p = put_str(p, mode_sgr[0]);
+            v->sgr = 0;
+            p = put_str(p, tail);
+        }
+        if (last && !v->dry) v->fresh = 1;
+    }
+    return (size_t)(p - buf);
+}
+
+size_t icosa_measure(struct icosa *v, int whole) {
+    size_t cap = icosa_chunk_min(v->cw), total = 0, n;
+    if (cap > v->scratch_cap) {
+        char *s = realloc(v->scratch, cap);
+        if (!s) return 0;
+        v->scratch = s;
+        v->scratch_cap = cap;
+    }
+    int row = v->row, full = v->full, opened = v->opened, sgr = v->sgr;
+    v->dry = 1;
+    if (whole) v->full = 1;
+    while ((n = icosa_encode(v, v->scratch, cap)) > 0) total += n;
+    v->dry = 0;
+    v->row = row;
+    v->full = full;
+    v->opened = opened;
+    v->sgr = sgr;
+    return total;
+}
+
+int icosa_encode_iov(struct icosa *v, struct iovec *iov, int iovcnt) {
+    int i;
+    for (i = 0; i < iovcnt && v->row < v->ch; i++)
+        iov[i].iov_len = icosa_encode(v, iov[i].iov_base, iov[i].iov_len);
+    return i;
+}
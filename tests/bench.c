@@ -0,0 +1,258 @@
+/* bench.c — Microbenchmarks for the renderer's hot paths
+ *
+ * Built against libicosa.c itself rather than the library, so the static
+ * functions can be timed one by one. Every benchmark runs at each size in
+ * sizes[], warms up, then takes TRIALS timed runs; one JSON object per
+ * line goes to stdout:
+ *
+ *     {"bench":"draw_line/long","cols":80,"rows":24,"iters":...,
+ *      "ns_op_min":...,"ns_op_median":...,"bytes_op":...}
+ *
+ * bytes_op is what one op writes: cells for fb_clear and compute_*,
+ * the encoded frame for render, 0 for work that stays in registers or
+ * sets a handful of dots. An argument limits the run to benchmarks whose
+ * name starts with it.
+ *
+ * The render/ and vt/ benchmarks run consecutive frames with each encoder
+ * option. vt/ times the terminal's side, feeding frames encoded beforehand
+ * to the model in vt.c, and adds "seqs_op" and "cells_op": the control
+ * sequences it acted on and the cells it wrote per frame.
+ */
+
+#include "../libicosa.c"
+#include "vt.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define TRIALS 7
+#define TRIAL_NS 20000000.0  /* aim for ~20ms per trial */
+#define WARMUP_NS 50000000.0
+
+static const int sizes[][2] = { {80, 24}, {132, 43}, {200, 60}, {320, 100}, {500, 200} };
+#define NSIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+#define NSTATES 64 /* states cycled through, so no one frame is special */
+static struct icosa_state states[NSTATES];
+static struct icosa_state seq[NSTATES]; /* frames 0..NSTATES-1 */
+static char *out;
+
+/* vt/: a loop of frames encoded ahead of time, and the model they go to */
+static char *frames;
+static size_t frame_off[NSTATES + 1];
+static struct vt term;
+static float proj_sink[NVERTS][2];
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Keep the compiler from dropping or merging writes nothing reads */
+#define CLOBBER() __asm__ volatile("" ::: "memory")
+
+struct bench {
+    const char *name;
+    size_t (*op)(struct icosa *v, uint32_t i); /* returns bytes written */
+    unsigned flags;                            /* the context's options */
+    unsigned merge;
+};
+
+static size_t op_fb_clear(struct icosa *v, uint32_t i) {
+    (void)i;
+    fb_clear(v);
+    return (size_t)v->cw * v->ch;
+}
+
+static size_t op_compute_floor(struct icosa *v, uint32_t i) {
+    (void)i;
+    compute_floor(v);
+    return (size_t)v->cw * v->ch;
+}
+
+static size_t op_compute_fine(struct icosa *v, uint32_t i) {
+    (void)i;
+    compute_fine(v);
+    return (size_t)v->cw * v->ch;
+}
+
+static size_t op_compute_smooth(struct icosa *v, uint32_t i) {
+    (void)i;
+    compute_smooth(v);
+    return (size_t)v->cw * v->ch;
+}
+
+static size_t op_line_short(struct icosa *v, uint32_t i) {
+    int x = (int)(i % (uint32_t)(v->pw - 4)), y = v->ph / 2;
+    draw_line(v, x, y, x + 3, y + 1);
+    return 0;
+}
+
+static size_t op_line_long(struct icosa *v, uint32_t i) {
+    int y = (int)(i % (uint32_t)v->ph);
+    draw_line(v, 0, y, v->pw - 1, v->ph - 1 - y);
+    return 0;
+}
+
+static size_t op_line_diagonal(struct icosa *v, uint32_t i) {
+    if (i & 1) draw_line(v, 0, 0, v->pw - 1, v->ph - 1);
+    else draw_line(v, v->pw - 1, 0, 0, v->ph - 1);
+    return 0;
+}
+
+/* Entirely above the view: every dot is walked and clipped */
+static size_t op_line_offscreen(struct icosa *v, uint32_t i) {
+    (void)i;
+    draw_line(v, -v->pw / 2, -v->ph, v->pw + v->pw / 2, -v->ph / 2);
+    return 0;
+}
+
+static size_t op_transform(struct icosa *v, uint32_t i) {
+    project(&states[i % NSTATES], v->center_x, v->floor_py, v->max_bounce,
+            v->scale, ASPECT, proj_sink, NULL);
+    return 0;
+}
+
+/* A whole frame, as the terminal loop does it: rasterize, then encode */
+static size_t op_render(struct icosa *v, uint32_t i) {
+    v->state = states[i % NSTATES];
+    icosa_rasterize(v);
+    return icosa_encode(v, out, icosa_frame_bound(v->cw, v->ch));
+}
+
+/* Consecutive frames, so diff encoding sees realistic changes */
+static size_t op_render_seq(struct icosa *v, uint32_t i) {
+    v->state = seq[i % NSTATES];
+    icosa_rasterize(v);
+    return icosa_encode(v, out, icosa_frame_bound(v->cw, v->ch));
+}
+
+static size_t op_vt(struct icosa *v, uint32_t i) {
+    (void)v;
+    i %= NSTATES;
+    vt_feed(&term, frames + frame_off[i], frame_off[i + 1] - frame_off[i]);
+    return frame_off[i + 1] - frame_off[i];
+}
+
+static const struct bench benches[] = {
+    { "fb_clear", op_fb_clear, 0 },
+    { "compute_floor", op_compute_floor, 0 },
+    { "compute_fine", op_compute_fine, ICOSA_FINE_FLOOR },
+    { "compute_smooth", op_compute_smooth, ICOSA_SMOOTH_FLOOR },
+    { "draw_line/short", op_line_short, 0 },
+    { "draw_line/long", op_line_long, 0 },
+    { "draw_line/diagonal", op_line_diagonal, 0 },
+    { "draw_line/offscreen", op_line_offscreen, 0 },
+    { "transform", op_transform, 0 },
+    { "render", op_render, 0 },
+    { "render/full", op_render_seq, 0 },
+    { "render/diff", op_render_seq, ICOSA_DIFF },
+    { "render/rle", op_render_seq, ICOSA_RLE },
+    { "render/diff+rle", op_render_seq, ICOSA_DIFF | ICOSA_RLE },
+    { "render/fine", op_render_seq, ICOSA_FINE_FLOOR },
+    { "render/fine+diff", op_render_seq, ICOSA_FINE_FLOOR | ICOSA_DIFF },
+    { "render/smooth", op_render_seq, ICOSA_SMOOTH_FLOOR },
+    { "render/shade", op_render_seq, ICOSA_SHADE },
+    { "render/shade+merge", op_render_seq, ICOSA_SHADE, 16 },
+    { "render/truecolor", op_render_seq, ICOSA_SHADE | ICOSA_TRUECOLOR },
+    { "render/truecolor+merge", op_render_seq, ICOSA_SHADE | ICOSA_TRUECOLOR, 16 },
+    { "render/truecolor+merge+diff", op_render_seq,
+      ICOSA_SHADE | ICOSA_TRUECOLOR | ICOSA_DIFF, 16 },
+    { "vt/full", op_vt, 0 },
+    { "vt/diff", op_vt, ICOSA_DIFF },
+    { "vt/rle", op_vt, ICOSA_RLE },
+    { "vt/diff+rle", op_vt, ICOSA_DIFF | ICOSA_RLE },
+};
+#define NBENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+/* Encode the loop of frames vt/ replays, each against the one before
+ * it; the loop wraps from the last frame to the first, so the diff frame
+ * there is larger than usual. The terminal starts out showing frame 0. */
+static int encode_frames(struct icosa *v) {
+    size_t bound = icosa_frame_bound(v->cw, v->ch);
+    char *p = realloc(frames, bound * NSTATES);
+    if (!p) return -1;
+    frames = p;
+    vt_free(&term);
+    if (vt_init(&term, v->cw, v->ch) < 0) return -1;
+    v->state = seq[0];
+    icosa_rasterize(v);
+    vt_feed(&term, frames, icosa_encode(v, frames, bound));
+    for (int i = 0; i < NSTATES; i++) {
+        v->state = seq[(i + 1) % NSTATES];
+        icosa_rasterize(v);
+        frame_off[i + 1] = frame_off[i] + icosa_encode(v, frames + frame_off[i], bound);
+    }
+    return 0;
+}
+
+static double run(const struct bench *b, struct icosa *v, uint32_t iters, size_t *bytes) {
+    size_t total = 0;
+    double t0 = now_ns();
+    for (uint32_t i = 0; i < iters; i++) {
+        total += b->op(v, i);
+        CLOBBER();
+    }
+    double t = now_ns() - t0;
+    *bytes = total;
+    return t;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    const char *only = argc > 1 ? argv[1] : "";
+
+    for (uint32_t i = 0; i < NSTATES; i++) {
+        icosa_state_at(&states[i], i * 37u); /* spread over the bounce */
+        icosa_state_at(&seq[i], i);
+    }
+    out = malloc(icosa_frame_bound(sizes[NSIZES - 1][0], sizes[NSIZES - 1][1]));
+    if (!out) return 1;
+
+    for (int bi = 0; bi < NBENCHES; bi++) {
+        const struct bench *b = &benches[bi];
+        if (strncmp(b->name, only, strlen(only)) != 0) continue;
+        for (int si = 0; si < NSIZES; si++) {
+            struct icosa_opts o = { b->flags, b->merge };
+            struct icosa *v = icosa_create(sizes[si][0], sizes[si][1], &o);
+            if (!v || (b->op == op_vt && encode_frames(v) < 0)) return 1;
+            update_tables(v); /* what the first frame would make */
+
+            /* Warm up while sizing the trials to about TRIAL_NS each */
+            uint32_t iters = 1;
+            size_t bytes;
+            double start = now_ns(), t;
+            while ((t = run(b, v, iters, &bytes)) < TRIAL_NS / 4 ||
+                   now_ns() - start < WARMUP_NS)
+                if (t < TRIAL_NS / 4 && iters < (1u << 30)) iters *= 2;
+            iters = (uint32_t)(iters * (TRIAL_NS / (t > 1 ? t : 1))) + 1;
+
+            double ns[TRIALS];
+            term.seqs = term.cell_writes = 0;
+            for (int k = 0; k < TRIALS; k++)
+                ns[k] = run(b, v, iters, &bytes) / iters;
+            qsort(ns, TRIALS, sizeof(ns[0]), cmp_double);
+
+            printf("{\"bench\":\"%s\",\"cols\":%d,\"rows\":%d,\"iters\":%u,"
+                   "\"ns_op_min\":%.1f,\"ns_op_median\":%.1f,\"bytes_op\":%.1f",
+                   b->name, sizes[si][0], sizes[si][1], iters, ns[0],
+                   ns[TRIALS / 2], (double)bytes / iters);
+            if (b->op == op_vt)
+                printf(",\"seqs_op\":%.1f,\"cells_op\":%.1f",
+                       (double)term.seqs / ((double)iters * TRIALS),
+                       (double)term.cell_writes / ((double)iters * TRIALS));
+            puts("}");
+            fflush(stdout);
+            icosa_destroy(v);
+        }
+    }
+    vt_free(&term);
+    free(frames);
+    free(out);
+    return 0;
+}
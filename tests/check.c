@@ -0,0 +1,722 @@
+/* check.c — Golden-frame regression test for libicosa
+ *
+ * Renders a matrix of terminal sizes and frame indices and compares, for
+ * each, a hash of the dot framebuffer and of the encoded bytes against
+ * tests/golden.txt. Every frame is also redrawn by the plain reference
+ * renderer below, and the first cell or byte where the library differs
+ * is reported, so an optimization that changes output shows exactly
+ * where. `check --write` prints a fresh golden file.
+ *
+ * Then a run of consecutive frames, with a resize and a cleared screen
+ * along the way, is encoded with each of the encoder options and fed to
+ * the terminal model in vt.c; every option must leave the same screen as
+ * the full encoder, and that screen must be the rasterized cells.
+ *
+ * Given the icosa binary as well, its first headless frame must be the
+ * library's frame 1, the first step from the top of the bounce.
+ *
+ * The --serve daemon is driven over socketpairs: icosa.c is built in, with
+ * its main() renamed, so its static serve_*() functions can be called.
+ */
+
+#include "icosa.h"
+#include "vt.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define main icosa_main
+#include "../icosa.c"
+#undef main
+
+static const int sizes[][2] = {
+    {20, 10}, {80, 24}, {81, 25}, {132, 43}, {200, 60}, {317, 101}, {500, 200},
+};
+static const uint32_t frames[] = { 0, 1, 17, 60, 151, 152, 293, 1000, 100000 };
+
+#define NSIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+#define NFRAMES (int)(sizeof(frames) / sizeof(frames[0]))
+#define FNV_BASIS 0xcbf29ce484222325ULL /* for icosa.c's fnv1a() */
+
+/* Reference renderer: the scene as first written, one dot at a time */
+
+static const float verts[14][3] = {
+    { 1,  1,  1}, { 1,  1, -1}, { 1, -1,  1}, { 1, -1, -1},
+    {-1,  1,  1}, {-1,  1, -1}, {-1, -1,  1}, {-1, -1, -1},
+    {1.5f, 0, 0}, {-1.5f, 0, 0}, {0, 1.5f, 0}, {0, -1.5f, 0}, {0, 0, 1.5f}, {0, 0, -1.5f}
+};
+
+static const int edges[36][2] = {
+    {0,1},{0,2},{0,4},{1,3},{1,5},{2,3},{2,6},{3,7},{4,5},{4,6},{5,7},{6,7},
+    {8,0},{8,1},{8,2},{8,3}, {9,4},{9,5},{9,6},{9,7},
+    {10,0},{10,1},{10,4},{10,5}, {11,2},{11,3},{11,6},{11,7},
+    {12,0},{12,2},{12,4},{12,6}, {13,1},{13,3},{13,5},{13,7}
+};
+
+static const char *const sgr[4] = {
+    "\033[0m", "\033[48;5;236m", "\033[48;5;252m", "\033[0;96m"
+};
+
+static void ref_dot(unsigned char *fb, int cw, int ch, int x, int y) {
+    static const unsigned char bits[2][4] = {
+        {0x01, 0x02, 0x04, 0x40},
+        {0x08, 0x10, 0x20, 0x80}
+    };
+    if (x < 0 || x >= cw * 2 || y < 0 || y >= ch * 4) return;
+    fb[(y / 4) * cw + (x / 2)] |= bits[x & 1][y & 3];
+}
+
+static void ref_draw(const struct icosa_state *s, int cw, int ch,
+                     unsigned char *fb, unsigned char *floor) {
+    int pw = cw * 2, ph = ch * 4, horizon = ch * 55 / 100;
+    for (int row = 0; row < ch; row++)
+        for (int col = 0; col < cw; col++) {
+            unsigned char m = 0;
+            if (row > horizon) {
+                float z = 1.0f / ((float)(row - horizon) / (float)(ch - horizon));
+                int iz = (int)floorf(z * 4.0f);
+                int ix = (int)floorf(((float)col / (float)cw - 0.5f) * z * 8.0f);
+                m = ((ix + iz) & 1) ? 1 : 2;
+            }
+            floor[row * cw + col] = m;
+        }
+
+    memset(fb, 0, (size_t)cw * ch);
+    float scale = fminf((float)pw, (float)ph) * 0.45f;
+    float floor_py = (float)(horizon * 4);
+    float cx = (float)pw / 2.0f;
+    float cy = floor_py - s->pos * floor_py * 0.55f - scale * 0.2f;
+    float s1 = sinf(s->rot[0]), c1 = cosf(s->rot[0]);
+    float s2 = sinf(s->rot[1]), c2 = cosf(s->rot[1]);
+    float s3 = sinf(s->rot[2]), c3 = cosf(s->rot[2]);
+    float proj[14][2];
+    for (int i = 0; i < 14; i++) {
+        float x = verts[i][0], y = verts[i][1], z = verts[i][2];
+        float y1 = y * c1 - z * s1;
+        float z1 = y * s1 + z * c1;
+        float x2 = x * c2 + z1 * s2;
+        float z2 = -x * s2 + z1 * c2;
+        float x3 = (x2 * c3 - y1 * s3) * (1.0f + s->squash * 0.5f);
+        float y3 = (x2 * s3 + y1 * c3) * (1.0f - s->squash);
+        float d = 5.0f + z2 * 0.3f;
+        proj[i][0] = cx + (x3 / d) * scale;
+        proj[i][1] = cy + (y3 / d) * scale;
+    }
+    for (int i = 0; i < 36; i++) {
+        int x0 = (int)proj[edges[i][0]][0], y0 = (int)proj[edges[i][0]][1];
+        int x1 = (int)proj[edges[i][1]][0], y1 = (int)proj[edges[i][1]][1];
+        int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+        int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+        int err = dx + dy;
+        for (;;) {
+            ref_dot(fb, cw, ch, x0, y0);
+            if (x0 == x1 && y0 == y1) break;
+            int e2 = 2 * err;
+            if (e2 >= dy) { err += dy; x0 += sx; }
+            if (e2 <= dx) { err += dx; y0 += sy; }
+        }
+    }
+}
+
+static size_t ref_encode(const unsigned char *fb, const unsigned char *floor,
+                         int cw, int ch, char *out) {
+    char *p = out;
+    p += sprintf(p, "\033[?2026h\033[H");
+    for (int y = 0; y < ch; y++) {
+        int prev = -1;
+        for (int x = 0; x < cw; x++) {
+            unsigned char d = fb[y * cw + x];
+            int mode = d ? 3 : floor[y * cw + x];
+            if (mode != prev) p += sprintf(p, "%s", sgr[mode]);
+            prev = mode;
+            if (d) {
+                unsigned cp = 0x2800u + d;
+                *p++ = (char)(0xE0 | (cp >> 12));
+                *p++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                *p++ = (char)(0x80 | (cp & 0x3F));
+            } else {
+                *p++ = ' ';
+            }
+        }
+        p += sprintf(p, "%s", sgr[0]);
+        if (y < ch - 1) *p++ = '\n';
+    }
+    p += sprintf(p, "\033[?2026l");
+    return (size_t)(p - out);
+}
+
+/* Library output, encoded in the smallest chunks the API allows so the
+ * resumable encoder is exercised too */
+static size_t lib_encode(struct icosa *ctx, int cw, char *out) {
+    size_t len = 0, n, chunk = icosa_chunk_min(cw);
+    while ((n = icosa_encode(ctx, out + len, chunk)) > 0) len += n;
+    return len;
+}
+
+static int first_diff(const unsigned char *a, const unsigned char *b, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        if (a[i] != b[i]) return (int)i;
+    return -1;
+}
+
+/* Screens: every encoder option leaves what the full encoder does with
+ * the same look, the first entry with the same LOOK flags */
+
+static const unsigned screen_flags[] = {
+    0, ICOSA_DIFF, ICOSA_RLE, ICOSA_DIFF | ICOSA_RLE,
+    ICOSA_ASCII, ICOSA_ASCII | ICOSA_DIFF | ICOSA_RLE,
+    ICOSA_NO_FLOOR, ICOSA_NO_FLOOR | ICOSA_DIFF | ICOSA_RLE,
+    ICOSA_FINE_FLOOR, ICOSA_FINE_FLOOR | ICOSA_DIFF, ICOSA_FINE_FLOOR | ICOSA_RLE,
+    ICOSA_FINE_FLOOR | ICOSA_DIFF | ICOSA_RLE,
+    ICOSA_SMOOTH_FLOOR, ICOSA_SMOOTH_FLOOR | ICOSA_DIFF | ICOSA_RLE,
+    ICOSA_SHADE, ICOSA_SHADE | ICOSA_DIFF, ICOSA_SHADE | ICOSA_DIFF | ICOSA_RLE,
+    ICOSA_SHADE | ICOSA_TRUECOLOR, ICOSA_SHADE | ICOSA_TRUECOLOR | ICOSA_DIFF | ICOSA_RLE,
+    ICOSA_SHADE | ICOSA_FINE_FLOOR, ICOSA_SHADE | ICOSA_FINE_FLOOR | ICOSA_DIFF,
+};
+#define NMODES (int)(sizeof(screen_flags) / sizeof(screen_flags[0]))
+#define LOOK (ICOSA_ASCII | ICOSA_NO_FLOOR | ICOSA_FINE_FLOOR | ICOSA_SMOOTH_FLOOR | \
+              ICOSA_SHADE | ICOSA_TRUECOLOR)
+#define SCREEN_MERGE 12
+#define SCREEN_FRAMES 240
+
+static const char *flag_name(unsigned f) {
+    static const char *const names[] = { "nosync", "diff", "rle", "noback", "half", "ascii",
+                                         "nofloor", "fine", "smooth", "shade",
+                                         "truecolor" };
+    static char buf[64];
+    buf[0] = '\0';
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (f & (1u << i)) {
+            if (buf[0]) strcat(buf, "+");
+            strcat(buf, names[i]);
+        }
+    return buf[0] ? buf : "full";
+}
+
+static int look_ref(int m) {
+    int r = 0;
+    while (screen_flags[r] != (screen_flags[m] & LOOK)) r++;
+    return r;
+}
+
+/* The character a cell's dots should show in the glyph set built in,
+ * worked out from the Unicode charts rather than taken from the library's
+ * tables. The octant and sextant blocks hold, in bit order, only the
+ * patterns that had no character before them. */
+static const unsigned quadrants[16] = {
+    ' ', 0x2598, 0x259d, 0x2580, 0x2596, 0x258c, 0x259e, 0x259b,
+    0x2597, 0x259a, 0x2590, 0x259c, 0x2584, 0x2599, 0x259f, 0x2588,
+};
+
+/* An octant pattern's earlier character, or 0: a quadrant pattern when
+ * both octants of each quadrant agree, else a row or corner quarter */
+static unsigned octant_old(unsigned d) {
+    static const unsigned quarter[][2] = {
+        {0x03, 0x1fb82}, {0xc0, 0x2582}, {0x3f, 0x1fb85}, {0xfc, 0x2586},
+        {0x01, 0x1cea8}, {0x02, 0x1ceab}, {0x40, 0x1cea3}, {0x80, 0x1cea0},
+        {0x14, 0x1fbe6}, {0x28, 0x1fbe7},
+    };
+    unsigned q = 0;
+    for (int i = 0; i < 4; i++) {
+        unsigned pair = d >> ((i >> 1) * 4 + (i & 1)) & 5; /* octants one above the other */
+        if (pair == 5) q |= 1u << i;
+        else if (pair) q = 16;
+    }
+    if (q < 16) return quadrants[q];
+    for (int i = 0; i < (int)(sizeof(quarter) / sizeof(quarter[0])); i++)
+        if (quarter[i][0] == d) return quarter[i][1];
+    return 0;
+}
+
+static unsigned ref_glyph(unsigned d) {
+    static const char ascii[16] = " ''-.|/+.\\|+_++#";
+    unsigned n = 0;
+    switch (icosa_glyphs()) {
+    case ICOSA_GLYPHS_OCTANT:
+        if (octant_old(d)) return octant_old(d);
+        for (unsigned e = 0; e < d; e++) n += !octant_old(e);
+        return 0x1cd00 + n;
+    case ICOSA_GLYPHS_SEXTANT:
+        if (d == 0x15 || d == 0x2a || d == 0x3f) return d == 0x15 ? 0x258c : d == 0x2a ? 0x2590 : 0x2588;
+        return 0x1fb00 + d - 1 - (d > 0x15) - (d > 0x2a);
+    case ICOSA_GLYPHS_QUADRANT:
+        return quadrants[d];
+    case ICOSA_GLYPHS_HALF:
+        return quadrants[(d & 1 ? 3 : 0) | (d & 2 ? 12 : 0)];
+    case ICOSA_GLYPHS_ASCII:
+        return (unsigned char)ascii[d];
+    }
+    return 0x2800u + d;
+}
+
+/* The screen the rasterized cells describe */
+static void expect_screen(struct icosa *ctx, struct vt *t) {
+    static const int32_t bg[3] = { VT_DEFAULT, 236, 252 };
+    const unsigned char *fb, *floor;
+    icosa_cells(ctx, &fb, &floor);
+    for (size_t i = 0; i < (size_t)t->cols * t->rows; i++)
+        t->cells[i] = fb[i] ? (struct vt_cell){ ref_glyph(fb[i]), 14, VT_DEFAULT }
+                            : (struct vt_cell){ ' ', VT_DEFAULT, bg[floor[i]] };
+}
+
+/* The same with ICOSA_FINE_FLOOR: the floor's lower half sampled half a
+ * cell further down, shown as a half block where the halves differ */
+static void expect_fine(struct icosa *ctx, struct vt *t) {
+    static const int32_t color[3] = { VT_DEFAULT, 236, 252 };
+    const unsigned char *fb, *floor;
+    icosa_cells(ctx, &fb, &floor);
+    expect_screen(ctx, t);
+    int cw = t->cols, ch = t->rows, horizon = ch * 55 / 100;
+    for (int row = horizon; row < ch; row++)
+        for (int col = 0; col < cw; col++) {
+            float z = 1.0f / (((float)(row - horizon) + 0.5f) / (float)(ch - horizon));
+            int iz = (int)floorf(z * 4.0f);
+            int ix = (int)floorf(((float)col / (float)cw - 0.5f) * z * 8.0f);
+            int top = floor[row * cw + col], bottom = ((ix + iz) & 1) ? 1 : 2;
+            struct vt_cell *c = &t->cells[row * cw + col];
+            if (fb[row * cw + col] || top == bottom) continue;
+            *c = top ? (struct vt_cell){ 0x2580, color[top], color[bottom] }
+                     : (struct vt_cell){ 0x2584, color[bottom], VT_DEFAULT };
+        }
+}
+
+/* ICOSA_SMOOTH_FLOOR: the first floor cell whose gray isn't the share of
+ * 4x4 point samples on light squares, or -1. Samples within rounding of a
+ * square's edge may count either way. */
+static long check_smooth(const struct vt *t) {
+    int cw = t->cols, ch = t->rows, horizon = ch * 55 / 100;
+    for (int row = horizon + 1; row < ch; row++)
+        for (int col = 0; col < cw; col++) {
+            const struct vt_cell *c = &t->cells[row * cw + col];
+            if (c->cp != ' ') continue; /* the object */
+            int light = 0, edge = 0;
+            for (int sy = 0; sy < 4; sy++)
+                for (int sx = 0; sx < 4; sx++) {
+                    double z = (ch - horizon) / (row - horizon + (sy + 0.5) / 4);
+                    double x = ((col + (sx + 0.5) / 4) / cw - 0.5) * z * 8;
+                    if (fabs(x - round(x)) < 1e-4 || fabs(z * 4 - round(z * 4)) < 1e-4) edge++;
+                    else light += (((int)floor(x) + (int)floor(z * 4)) & 1) == 0;
+                }
+            if (c->bg < 236 + light || c->bg > 236 + light + edge) return row * cw + col;
+        }
+    return -1;
+}
+
+/* A color as the test terminal holds it, in RGB: 24-bit, or from the
+ * 256-color palette's cube or gray ramp */
+static int vt_rgb(int32_t c, int rgb[3]) {
+    static const int cube[6] = { 0, 95, 135, 175, 215, 255 };
+    if (c & 0x1000000) {
+        for (int i = 0; i < 3; i++) rgb[i] = c >> (16 - 8 * i) & 0xff;
+    } else if (c >= 232 && c < 256) {
+        rgb[0] = rgb[1] = rgb[2] = 8 + 10 * (c - 232);
+    } else if (c >= 16 && c < 232) {
+        rgb[0] = cube[(c - 16) / 36], rgb[1] = cube[(c - 16) / 6 % 6], rgb[2] = cube[(c - 16) % 6];
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* ICOSA_SHADE: the first cell whose color is more than tol from what it
+ * should be, or -1. The floor is its color fading into black at e^-0.2
+ * per unit of depth beyond the nearest, from the middle of the cell; the
+ * object is cyan from a quarter to full brightness. */
+static long check_shade(struct icosa *ctx, const struct vt *t, int tol) {
+    static const int floor_rgb[3] = { 0, 0x30, 0xd0 };
+    const unsigned char *fb, *floor;
+    icosa_cells(ctx, &fb, &floor);
+    int cw = t->cols, ch = t->rows, horizon = ch * 55 / 100;
+    for (int i = 0; i < cw * ch; i++) {
+        const struct vt_cell *c = &t->cells[i];
+        int rgb[3];
+        if (fb[i]) {
+            if (vt_rgb(c->fg, rgb) < 0 || rgb[0] > tol || abs(rgb[1] - rgb[2]) > tol ||
+                rgb[1] < 0xff / 4 - tol)
+                return i;
+        } else if (!floor[i]) {
+            if (c->bg != VT_DEFAULT) return i;
+        } else {
+            double z = (double)(ch - horizon) / (i / cw - horizon + 0.5);
+            int want = (int)(floor_rgb[floor[i]] * exp((1 - z) * 0.2));
+            if (vt_rgb(c->bg, rgb) < 0) return i;
+            for (int k = 0; k < 3; k++)
+                if (abs(rgb[k] - want) > tol) return i;
+        }
+    }
+    return -1;
+}
+
+static int check_screens(int cw, int ch, int cw2, int ch2) {
+    struct icosa *ctx[NMODES];
+    struct vt vt[NMODES], want;
+    char *buf = malloc(icosa_frame_bound(cw > cw2 ? cw : cw2, ch > ch2 ? ch : ch2));
+    if (!buf) return 1;
+    for (int m = 0; m < NMODES; m++) {
+        struct icosa_opts o = { screen_flags[m], SCREEN_MERGE };
+        ctx[m] = icosa_create(cw, ch, &o);
+        if (!ctx[m] || vt_init(&vt[m], cw, ch) < 0) return 1;
+    }
+    if (vt_init(&want, cw, ch) < 0) return 1;
+
+    int bad = 0;
+    for (uint32_t f = 0; f < SCREEN_FRAMES && !bad; f++) {
+        if (f == SCREEN_FRAMES / 2) { /* resize, onto a cleared screen */
+            cw = cw2, ch = ch2;
+            vt_free(&want);
+            if (vt_init(&want, cw, ch) < 0) return 1;
+            for (int m = 0; m < NMODES; m++) {
+                vt_free(&vt[m]);
+                if (icosa_resize(ctx[m], cw, ch) < 0 || vt_init(&vt[m], cw, ch) < 0) return 1;
+            }
+        }
+        if (f == SCREEN_FRAMES * 3 / 4) { /* someone else cleared it */
+            for (int m = 0; m < NMODES; m++) {
+                vt_feed(&vt[m], "\033[2J", 4);
+                icosa_invalidate(ctx[m]);
+            }
+        }
+        for (int m = 0; m < NMODES; m++) {
+            icosa_state_at(icosa_state(ctx[m]), f);
+            icosa_rasterize(ctx[m]);
+            size_t want = icosa_measure(ctx[m], 0);
+            size_t len = lib_encode(ctx[m], cw, buf);
+            vt_feed(&vt[m], buf, len);
+            if (want != len) {
+                printf("FAIL %dx%d frame %u: %s encoding measured %zu bytes, wrote %zu\n",
+                       cw, ch, f, flag_name(screen_flags[m]), want, len);
+                bad = 1;
+            }
+        }
+        expect_screen(ctx[0], &want);
+        long c = vt_compare(&vt[0], &want);
+        if (c >= 0) {
+            printf("FAIL screen %dx%d frame %u: full encoding shows U+%04X at (%ld,%ld), "
+                   "cells say U+%04X\n", cw, ch, f, vt[0].cells[c].cp, c % cw, c / cw,
+                   want.cells[c].cp);
+            bad = 1;
+        }
+        for (int m = 1; m < NMODES && !bad; m++) {
+            if (screen_flags[m] == ICOSA_FINE_FLOOR) {
+                expect_fine(ctx[m], &want);
+                c = vt_compare(&vt[m], &want);
+                if (c >= 0) {
+                    printf("FAIL screen %dx%d frame %u: fine floor shows U+%04X fg %d bg %d "
+                           "at (%ld,%ld), expected U+%04X fg %d bg %d\n", cw, ch, f,
+                           vt[m].cells[c].cp, vt[m].cells[c].fg, vt[m].cells[c].bg, c % cw,
+                           c / cw, want.cells[c].cp, want.cells[c].fg, want.cells[c].bg);
+                    bad = 1;
+                }
+            }
+            if (screen_flags[m] == ICOSA_SMOOTH_FLOOR && (c = check_smooth(&vt[m])) >= 0) {
+                printf("FAIL screen %dx%d frame %u: smooth floor at (%ld,%ld) is color %d\n",
+                       cw, ch, f, c % cw, c / cw, vt[m].cells[c].bg);
+                bad = 1;
+            }
+            if ((screen_flags[m] == ICOSA_SHADE || screen_flags[m] == (ICOSA_SHADE | ICOSA_TRUECOLOR)) &&
+                (c = check_shade(ctx[m], &vt[m], screen_flags[m] & ICOSA_TRUECOLOR ? SCREEN_MERGE + 4
+                                                                                   : SCREEN_MERGE + 24)) >= 0) {
+                printf("FAIL screen %dx%d frame %u: %s shows fg %d bg %d at (%ld,%ld)\n", cw, ch, f,
+                       flag_name(screen_flags[m]), vt[m].cells[c].fg, vt[m].cells[c].bg, c % cw, c / cw);
+                bad = 1;
+            }
+            int r = look_ref(m);
+            if (r == m) continue;
+            c = vt_compare(&vt[m], &vt[r]);
+            if (c >= 0) {
+                printf("FAIL screen %dx%d frame %u: %s encoding differs from %s at "
+                       "(%ld,%ld): U+%04X bg %d, ", cw, ch, f, flag_name(screen_flags[m]),
+                       flag_name(screen_flags[r]), c % cw, c / cw, vt[m].cells[c].cp,
+                       vt[m].cells[c].bg);
+                printf("%s U+%04X bg %d\n", flag_name(screen_flags[r]),
+                       vt[r].cells[c].cp, vt[r].cells[c].bg);
+                bad = 1;
+            }
+        }
+    }
+    for (int m = 0; m < NMODES; m++) {
+        vt_free(&vt[m]);
+        icosa_destroy(ctx[m]);
+    }
+    vt_free(&want);
+    free(buf);
+    return bad;
+}
+
+/* The first frame of `icosa --headless` against the library's frame 1 */
+static int check_headless(const char *icosa) {
+    enum { CW = 80, CH = 24 };
+    char cmd[4096];
+    snprintf(cmd, sizeof(cmd), "%s --headless --frames 1 --size %dx%d", icosa, CW, CH);
+    FILE *p = popen(cmd, "r");
+    size_t bound = icosa_frame_bound(CW, CH), len = 0, n;
+    char *buf = malloc(bound);
+    struct vt got, want;
+    struct icosa *ctx = icosa_create(CW, CH, NULL);
+    if (!p || !buf || !ctx || vt_init(&got, CW, CH) < 0 || vt_init(&want, CW, CH) < 0) {
+        fputs("check: can't run the headless check\n", stderr);
+        return 1;
+    }
+    char chunk[4096];
+    while ((n = fread(chunk, 1, sizeof(chunk), p)) > 0) vt_feed(&got, chunk, n);
+    int status = pclose(p);
+
+    icosa_state_at(icosa_state(ctx), 1);
+    icosa_rasterize(ctx);
+    while ((n = icosa_encode(ctx, buf + len, bound - len)) > 0) len += n;
+    vt_feed(&want, buf, len);
+    long c = vt_compare(&got, &want);
+    int bad = status != 0 || c >= 0;
+    if (status != 0) printf("FAIL headless: %s exited with status %d\n", icosa, status);
+    else if (c >= 0)
+        printf("FAIL headless: first frame shows U+%04X at (%ld,%ld), frame 1 has U+%04X\n",
+               got.cells[c].cp, c % CW, c / CW, want.cells[c].cp);
+    vt_free(&got);
+    vt_free(&want);
+    icosa_destroy(ctx);
+    free(buf);
+    return bad;
+}
+
+/* Whatever the daemon has sent on fd, fed to t; the byte count */
+static size_t serve_recv(int fd, struct vt *t) {
+    char chunk[4096];
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        vt_feed(t, chunk, (size_t)n);
+        total += (size_t)n;
+    }
+    return total;
+}
+
+/* The daemon's current frame, as the library draws it, fed to t */
+static void serve_expect(struct icosa *ctx, char *buf, size_t bound, struct vt *t) {
+    size_t len = 0, n;
+    *icosa_state(ctx) = srv.state;
+    icosa_rasterize(ctx);
+    while ((n = icosa_encode(ctx, buf + len, bound - len)) > 0) len += n;
+    vt_feed(t, buf, len);
+}
+
+/* Two clients of one size on socketpairs. The one that reads must see
+ * every frame as the library draws it; the one that doesn't must skip
+ * frames without holding the other up, show the current frame once it
+ * reads again, and be dropped once it hangs up. */
+static int check_serve(void) {
+    enum { CW = 80, CH = 24, TICKS = 40 };
+    int fast[2], slow[2], small = 4096;
+    struct vt got, lag, want;
+    size_t bound = icosa_frame_bound(CW, CH), got_bytes = 0, lag_bytes;
+    char *buf = malloc(bound);
+    struct icosa *ctx = icosa_create(CW, CH, NULL);
+    if (!buf || !ctx || socketpair(AF_UNIX, SOCK_STREAM, 0, fast) < 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, slow) < 0 || vt_init(&got, CW, CH) < 0 ||
+        vt_init(&lag, CW, CH) < 0 || vt_init(&want, CW, CH) < 0) {
+        fputs("check: can't run the serve check\n", stderr);
+        return 1;
+    }
+    setsockopt(slow[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    fcntl(fast[1], F_SETFL, O_NONBLOCK);
+    fcntl(slow[1], F_SETFL, O_NONBLOCK);
+    icosa_state_init(&srv.state);
+    int bad = serve_add(fast[0]) < 0 || serve_add(slow[0]) < 0;
+    struct client *lagging = &srv.cl[1];
+    send_msg(fast[1], 'S', CW, CH);
+    send_msg(slow[1], 'S', CW, CH);
+    for (int i = 0; i < srv.ncl; i++) bad |= client_read(&srv.cl[i]) < 0;
+    if (bad || srv.nviews != 1) {
+        printf("FAIL serve: two clients of one size don't share a view\n");
+        bad = 1;
+    }
+
+    for (int f = 0; f < TICKS && !bad; f++) {
+        serve_tick();
+        got_bytes += serve_recv(fast[1], &got);
+        serve_expect(ctx, buf, bound, &want);
+        long c = vt_compare(&got, &want);
+        if (c >= 0) {
+            printf("FAIL serve: tick %d shows U+%04X at (%ld,%ld), the library U+%04X\n",
+                   f, got.cells[c].cp, c % CW, c / CW, want.cells[c].cp);
+            bad = 1;
+        }
+    }
+
+    /* What the daemon sent or kept for the slow client is less than the
+     * fast one read. Reading again, it gets the rest of the frame it was
+     * in the middle of, then the next one whole. */
+    lag_bytes = serve_recv(slow[1], &lag);
+    if (!bad && lag_bytes + lagging->pend_len >= got_bytes) {
+        printf("FAIL serve: a client that didn't read skipped no frames\n");
+        bad = 1;
+    }
+    for (int f = 0; f < 2 && !bad; f++) {
+        if (f) {
+            serve_tick();
+            serve_recv(fast[1], &got);
+            serve_expect(ctx, buf, bound, &want);
+        }
+        do {
+            if (client_flush(lagging) < 0) bad = 1;
+            serve_recv(slow[1], &lag);
+        } while (lagging->pend_len && !bad);
+    }
+    long c = bad ? -1 : vt_compare(&lag, &want);
+    if (c >= 0) {
+        printf("FAIL serve: caught up, the slow client shows U+%04X at (%ld,%ld), "
+               "the library U+%04X\n", lag.cells[c].cp, c % CW, c / CW, want.cells[c].cp);
+        bad = 1;
+    }
+
+    close(slow[1]);
+    serve_tick();
+    if (!bad && srv.ncl != 1) {
+        printf("FAIL serve: a client that hung up wasn't dropped\n");
+        bad = 1;
+    }
+    close(fast[1]);
+    while (srv.ncl) serve_drop(srv.ncl - 1);
+    if (!bad && srv.nviews != 0) {
+        printf("FAIL serve: a view outlived its clients\n");
+        bad = 1;
+    }
+    free(srv.frame);
+    free(srv.views);
+    free(srv.cl);
+    vt_free(&got);
+    vt_free(&lag);
+    vt_free(&want);
+    icosa_destroy(ctx);
+    free(buf);
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    int write = argc > 1 && strcmp(argv[1], "--write") == 0;
+    const char *golden = !write && argc > 1 ? argv[1] : "tests/golden.txt";
+    FILE *g = write ? NULL : fopen(golden, "r");
+    if (!write && !g) {
+        perror(golden);
+        return 2;
+    }
+
+    int failures = 0, checked = 0;
+
+    /* The golden hashes and the reference renderer are of braille; other
+     * glyph sets are checked only against the terminal model */
+    if (icosa_glyphs() != ICOSA_GLYPHS_BRAILLE) {
+        if (write) {
+            fputs("check: golden frames are written from a braille build\n", stderr);
+            return 2;
+        }
+        puts("glyphs aren't braille: skipping golden frames and the reference renderer");
+        goto screens;
+    }
+
+    /* The closed-form state must be exactly what stepping reaches */
+    struct icosa_state step, direct;
+    icosa_state_init(&step);
+    for (uint32_t f = 0, i = 0; i < NFRAMES; f++) {
+        if (f == frames[i]) {
+            icosa_state_at(&direct, f);
+            if (memcmp(&step, &direct, sizeof(step)) != 0) {
+                printf("FAIL state at frame %u: icosa_state_at differs from stepping\n", f);
+                failures++;
+            }
+            i++;
+        }
+        icosa_tick(&step);
+    }
+
+    for (int si = 0; si < NSIZES; si++) {
+        int cw = sizes[si][0], ch = sizes[si][1];
+        size_t cells = (size_t)cw * ch, bound = icosa_frame_bound(cw, ch);
+        struct icosa *ctx = icosa_create(cw, ch, NULL);
+        unsigned char *rfb = malloc(cells), *rfloor = malloc(cells);
+        char *lbuf = malloc(bound), *rbuf = malloc(bound * 2);
+        if (!ctx || !rfb || !rfloor || !lbuf || !rbuf) {
+            fputs("check: out of memory\n", stderr);
+            return 2;
+        }
+
+        for (int fi = 0; fi < NFRAMES; fi++) {
+            uint32_t f = frames[fi];
+            icosa_state_at(icosa_state(ctx), f);
+            icosa_rasterize(ctx);
+            const unsigned char *fb, *floor;
+            icosa_cells(ctx, &fb, &floor);
+            size_t len = lib_encode(ctx, cw, lbuf);
+            uint64_t hfb = fnv1a(FNV_BASIS, fb, cells), henc = fnv1a(FNV_BASIS, lbuf, len);
+            checked++;
+
+            if (write) {
+                printf("%d %d %u %016llx %016llx\n", cw, ch, f,
+                       (unsigned long long)hfb, (unsigned long long)henc);
+                continue;
+            }
+
+            int gcw, gch;
+            unsigned gf;
+            unsigned long long gfb, genc;
+            if (fscanf(g, "%d %d %u %llx %llx", &gcw, &gch, &gf, &gfb, &genc) != 5 ||
+                gcw != cw || gch != ch || gf != f) {
+                printf("FAIL %s doesn't match the test matrix at %dx%d frame %u "
+                       "(regenerate with make golden)\n", golden, cw, ch, f);
+                return 1;
+            }
+            int bad = gfb != hfb || genc != henc;
+            if (bad)
+                printf("FAIL %dx%d frame %u: %s%s hash differs from golden\n", cw, ch, f,
+                       gfb != hfb ? "fb" : "", gfb != hfb && genc != henc ? " and encoding" :
+                       genc != henc ? "encoding" : "");
+
+            /* Against the reference: first differing cell, then byte */
+            ref_draw(icosa_state(ctx), cw, ch, rfb, rfloor);
+            size_t rlen = ref_encode(rfb, rfloor, cw, ch, rbuf);
+            int c = first_diff(fb, rfb, cells);
+            int fl = first_diff(floor, rfloor, cells);
+            if (c >= 0) {
+                printf("FAIL %dx%d frame %u: cell (%d,%d) has dots %02x, reference %02x\n",
+                       cw, ch, f, c % cw, c / cw, fb[c], rfb[c]);
+                bad = 1;
+            } else if (fl >= 0) {
+                printf("FAIL %dx%d frame %u: floor cell (%d,%d) is %d, reference %d\n",
+                       cw, ch, f, fl % cw, fl / cw, floor[fl], rfloor[fl]);
+                bad = 1;
+            } else if (len != rlen || memcmp(lbuf, rbuf, len) != 0) {
+                int b = first_diff((unsigned char *)lbuf, (unsigned char *)rbuf,
+                                   len < rlen ? len : rlen);
+                printf("FAIL %dx%d frame %u: encoding differs from reference at byte %d "
+                       "(%zu bytes, reference %zu)\n", cw, ch, f, b < 0 ? (int)len : b,
+                       len, rlen);
+                bad = 1;
+            }
+            failures += bad;
+        }
+        free(rbuf);
+        free(lbuf);
+        free(rfloor);
+        free(rfb);
+        icosa_destroy(ctx);
+    }
+
+    if (g) fclose(g);
+    if (write) return 0;
+
+screens:
+    if (!write && argc > 2) {
+        failures += check_headless(argv[2]);
+        checked++;
+    }
+    failures += check_serve();
+    checked++;
+    for (int si = 0; si + 1 < NSIZES; si++) {
+        failures += check_screens(sizes[si][0], sizes[si][1],
+                                  sizes[si + 1][0], sizes[si + 1][1]);
+        checked += SCREEN_FRAMES;
+    }
+    printf("%s: %d frames checked, %d failed\n", failures ? "FAIL" : "ok", checked, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+/* ptybench.c — End-to-end throughput through a real pseudo-terminal
+ *
+ * Runs icosa --stats on the slave side of a pty of the given size and
+ * drains the master no faster than a given rate, as a slow SSH link
+ * would, so writes block in the kernel's tty buffering just as they do
+ * for real. One JSON line per run goes to stdout: the size and drain
+ * rate, the bytes the master read (after the tty's \n -> \r\n), and
+ * icosa's own report of frames, fps, bytes and time stalled in write().
+ *
+ *     ptybench [-s WxH] [-r BYTES_PER_SEC] [-l MS] [-n FRAMES] [ICOSA [ARGS...]]
+ *
+ * A rate of 0 drains as fast as the master can be read. Like a terminal,
+ * the harness answers each DSR (CSI 6n) when the drain reaches it, after
+ * a further -l MS of link latency; -l -1 leaves them unanswered.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TICK_MS 5 /* the drain budget is topped up this often */
+#define MAX_REPLIES 64
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int cols = 80, rows = 24, opt;
+    long rate = 0, frames = 90, latency = 0;
+    while ((opt = getopt(argc, argv, "+s:r:l:n:")) != -1) {
+        char x;
+        switch (opt) {
+        case 's':
+            if (sscanf(optarg, "%d%c%d", &cols, &x, &rows) != 3 || x != 'x') {
+                fprintf(stderr, "ptybench: bad size '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r': rate = atol(optarg); break;
+        case 'l': latency = atol(optarg); break;
+        case 'n': frames = atol(optarg); break;
+        default:
+            fputs("usage: ptybench [-s WxH] [-r BYTES_PER_SEC] [-l MS] [-n FRAMES] "
+                  "[ICOSA [ARGS...]]\n", stderr);
+            return 1;
+        }
+    }
+    const char *prog = optind < argc ? argv[optind++] : "./icosa";
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("ptybench: pty");
+        return 1;
+    }
+    struct winsize ws = { .ws_row = (unsigned short)rows, .ws_col = (unsigned short)cols };
+    ioctl(master, TIOCSWINSZ, &ws);
+    const char *slave = ptsname(master);
+
+    int errp[2];
+    if (pipe(errp) < 0) {
+        perror("ptybench: pipe");
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("ptybench: fork");
+        return 1;
+    }
+    if (pid == 0) {
+        /* A session of its own, with the slave as controlling terminal */
+        setsid();
+        int fd = open(slave, O_RDWR);
+        if (fd < 0) _exit(127);
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(errp[1], STDERR_FILENO);
+        close(fd);
+        close(master);
+        close(errp[0]);
+        close(errp[1]);
+
+        char nbuf[32];
+        snprintf(nbuf, sizeof(nbuf), "%ld", frames);
+        int extra = argc - optind;
+        char **args = calloc((size_t)extra + 5, sizeof(*args));
+        if (!args) _exit(127);
+        args[0] = (char *)prog;
+        args[1] = "--stats";
+        args[2] = "--frames";
+        args[3] = nbuf;
+        memcpy(args + 4, argv + optind, (size_t)extra * sizeof(*args));
+        execv(prog, args);
+        _exit(127);
+    }
+    close(errp[1]);
+
+    /* Drain under a byte budget topped up every tick, until the child
+     * has exited and the master has nothing left (EIO once the slave
+     * side is closed) */
+    static char buf[1 << 16];
+    unsigned long long drained = 0;
+    double budget = 0, last = now();
+    int status = 0, exited = 0;
+    double due[MAX_REPLIES]; /* when queued DSR answers go back */
+    int nreplies = 0, match = 0;
+    for (;;) {
+        if (!exited && waitpid(pid, &status, WNOHANG) == pid) exited = 1;
+
+        while (nreplies && due[0] <= now()) {
+            static const char cpr[] = "\033[1;1R";
+            if (!exited) write(master, cpr, sizeof(cpr) - 1);
+            memmove(due, due + 1, (size_t)--nreplies * sizeof(due[0]));
+        }
+
+        size_t want = sizeof(buf);
+        if (rate > 0) {
+            double t = now();
+            budget += (t - last) * (double)rate;
+            last = t;
+            if (budget > (double)rate * TICK_MS / 1000.0 * 4)
+                budget = (double)rate * TICK_MS / 1000.0 * 4; /* no bursts after idling */
+            if (budget < 1) {
+                usleep(TICK_MS * 1000);
+                continue;
+            }
+            if ((double)want > budget) want = (size_t)budget;
+        }
+
+        struct pollfd pfd = { .fd = master, .events = POLLIN };
+        int r = poll(&pfd, 1, exited ? 0 : nreplies ? 1 : TICK_MS);
+        if (r < 0 && errno != EINTR) break;
+        if (r <= 0) {
+            if (exited) break;
+            continue;
+        }
+        ssize_t n = read(master, buf, want);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            if (exited) break;
+            usleep(TICK_MS * 1000); /* EIO between close and exit */
+            continue;
+        }
+        drained += (unsigned long long)n;
+        budget -= (double)n;
+        for (ssize_t i = 0; i < n && latency >= 0; i++) {
+            static const char dsr[] = "\033[6n";
+            match = buf[i] == dsr[match] ? match + 1 : buf[i] == dsr[0];
+            if (match == 4) {
+                if (nreplies < MAX_REPLIES) due[nreplies++] = now() + latency / 1000.0;
+                match = 0;
+            }
+        }
+    }
+    if (!exited) waitpid(pid, &status, 0);
+
+    char report[512];
+    ssize_t n = read(errp[0], report, sizeof(report) - 1);
+    report[n > 0 ? n : 0] = '\0';
+    char *nl = strchr(report, '\n');
+    if (nl) *nl = '\0';
+    if (report[0] != '{' || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "ptybench: %s failed%s%s\n", prog, report[0] ? ": " : "", report);
+        return 1;
+    }
+
+    printf("{\"cols\":%d,\"rows\":%d,\"rate\":%ld,\"drained\":%llu,%s\n",
+           cols, rows, rate, drained, report + 1);
+    return 0;
+}
@@ -0,0 +1,208 @@
+/* vt.c — A minimal terminal model; see vt.h */
+
+#include "vt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum { GROUND, ESC, CSI };
+
+int vt_init(struct vt *t, int cols, int rows) {
+    memset(t, 0, sizeof(*t));
+    t->cells = malloc((size_t)cols * rows * sizeof(*t->cells));
+    if (!t->cells) return -1;
+    t->cols = cols;
+    t->rows = rows;
+    t->fg = t->bg = VT_DEFAULT;
+    for (size_t i = 0; i < (size_t)cols * rows; i++)
+        t->cells[i] = (struct vt_cell){ ' ', VT_DEFAULT, VT_DEFAULT };
+    return 0;
+}
+
+void vt_free(struct vt *t) {
+    free(t->cells);
+    t->cells = NULL;
+}
+
+static void erase(struct vt *t, size_t from, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        t->cells[from + i] = (struct vt_cell){ ' ', t->fg, t->bg };
+    t->cell_writes += n;
+}
+
+static void scroll_up(struct vt *t) {
+    size_t row = (size_t)t->cols;
+    memmove(t->cells, t->cells + row, (size_t)(t->rows - 1) * row * sizeof(*t->cells));
+    erase(t, (size_t)(t->rows - 1) * row, row);
+}
+
+static void linefeed(struct vt *t) {
+    if (t->y == t->rows - 1) scroll_up(t);
+    else t->y++;
+}
+
+static void print(struct vt *t, uint32_t cp) {
+    if (t->wrap) {
+        t->x = 0;
+        linefeed(t);
+        t->wrap = 0;
+    }
+    t->cells[(size_t)t->y * t->cols + t->x] = (struct vt_cell){ cp, t->fg, t->bg };
+    t->cell_writes++;
+    t->prints++;
+    t->last = cp;
+    if (t->x == t->cols - 1) t->wrap = 1;
+    else t->x++;
+}
+
+static unsigned param(const struct vt *t, int i, unsigned dflt) {
+    return i < t->nparams && t->params[i] ? t->params[i] : dflt;
+}
+
+static void sgr(struct vt *t) {
+    if (t->nparams == 0) t->nparams = 1, t->params[0] = 0;
+    for (int i = 0; i < t->nparams; i++) {
+        unsigned p = t->params[i];
+        int32_t *c = p == 38 || (p >= 30 && p <= 39) || (p >= 90 && p <= 97) ? &t->fg : &t->bg;
+        if (p == 0) {
+            t->fg = t->bg = VT_DEFAULT;
+        } else if (p == 39 || p == 49) {
+            *c = VT_DEFAULT;
+        } else if ((p >= 30 && p <= 37) || (p >= 40 && p <= 47)) {
+            *c = (int32_t)(p % 10);
+        } else if ((p >= 90 && p <= 97) || (p >= 100 && p <= 107)) {
+            *c = (int32_t)(p % 10 + 8);
+        } else if ((p == 38 || p == 48) && i + 2 < t->nparams && t->params[i + 1] == 5) {
+            *c = (int32_t)(t->params[i + 2] & 255);
+            i += 2;
+        } else if ((p == 38 || p == 48) && i + 4 < t->nparams && t->params[i + 1] == 2) {
+            *c = (int32_t)(0x1000000 | (t->params[i + 2] & 255) << 16 |
+                           (t->params[i + 3] & 255) << 8 | (t->params[i + 4] & 255));
+            i += 4;
+        }
+    }
+}
+
+static void csi(struct vt *t, char final) {
+    size_t at = (size_t)t->y * t->cols + t->x;
+    t->seqs++;
+    if (t->priv) return; /* modes: synchronized update, cursor, screen */
+    switch (final) {
+    case 'H':
+    case 'f':
+        t->y = (int)param(t, 0, 1) - 1;
+        t->x = (int)param(t, 1, 1) - 1;
+        if (t->y >= t->rows) t->y = t->rows - 1;
+        if (t->x >= t->cols) t->x = t->cols - 1;
+        t->wrap = 0;
+        break;
+    case 'C': {
+        unsigned n = param(t, 0, 1);
+        t->x = t->x + (int)n >= t->cols ? t->cols - 1 : t->x + (int)n;
+        t->wrap = 0;
+        break;
+    }
+    case 'J': {
+        size_t all = (size_t)t->cols * t->rows;
+        unsigned mode = param(t, 0, 0);
+        if (mode == 0) erase(t, at, all - at);
+        else if (mode == 1) erase(t, 0, at + 1);
+        else erase(t, 0, all);
+        break;
+    }
+    case 'K': {
+        size_t row = (size_t)t->y * t->cols;
+        unsigned mode = param(t, 0, 0);
+        if (mode == 0) erase(t, at, (size_t)(t->cols - t->x));
+        else if (mode == 1) erase(t, row, (size_t)t->x + 1);
+        else erase(t, row, (size_t)t->cols);
+        break;
+    }
+    case 'X': {
+        unsigned n = param(t, 0, 1);
+        if (n > (unsigned)(t->cols - t->x)) n = (unsigned)(t->cols - t->x);
+        erase(t, at, n);
+        t->wrap = 0;
+        break;
+    }
+    case 'b':
+        if (t->last)
+            for (unsigned n = param(t, 0, 1); n > 0; n--) print(t, t->last);
+        break;
+    case 'm':
+        sgr(t);
+        break;
+    }
+}
+
+void vt_feed(struct vt *t, const char *p, size_t n) {
+    t->bytes += n;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        switch (t->state) {
+        case ESC:
+            if (c == '[') {
+                t->state = CSI;
+                t->nparams = 0;
+                t->priv = 0;
+                memset(t->params, 0, sizeof(t->params));
+            } else {
+                t->state = GROUND; /* two-byte escapes don't occur */
+            }
+            continue;
+        case CSI:
+            if (c >= '0' && c <= '9') {
+                if (t->nparams == 0) t->nparams = 1;
+                unsigned *v = &t->params[t->nparams - 1];
+                *v = *v * 10 + (c - '0');
+            } else if (c == ';') {
+                if (t->nparams == 0) t->nparams = 1;
+                if (t->nparams < 16) t->nparams++;
+            } else if (c >= '<' && c <= '?') {
+                t->priv = 1;
+            } else if (c >= 0x40 && c <= 0x7e) {
+                csi(t, (char)c);
+                t->state = GROUND;
+            }
+            continue;
+        }
+
+        if (t->utf8_need) {
+            t->utf8 = (t->utf8 << 6) | (c & 0x3f);
+            if (--t->utf8_need == 0) print(t, t->utf8);
+            continue;
+        }
+        if (c == 0x1b) {
+            t->state = ESC;
+        } else if (c == '\n') {
+            t->seqs++;
+            t->x = 0;
+            t->wrap = 0;
+            linefeed(t);
+        } else if (c == '\r') {
+            t->seqs++;
+            t->x = 0;
+            t->wrap = 0;
+        } else if (c >= 0xf0) {
+            t->utf8 = c & 0x07;
+            t->utf8_need = 3;
+        } else if (c >= 0xe0) {
+            t->utf8 = c & 0x0f;
+            t->utf8_need = 2;
+        } else if (c >= 0xc0) {
+            t->utf8 = c & 0x1f;
+            t->utf8_need = 1;
+        } else if (c >= 0x20 && c < 0x7f) {
+            print(t, c);
+        }
+    }
+}
+
+long vt_compare(const struct vt *a, const struct vt *b) {
+    for (size_t i = 0; i < (size_t)a->cols * a->rows; i++) {
+        const struct vt_cell *x = &a->cells[i], *y = &b->cells[i];
+        if (x->cp != y->cp || x->bg != y->bg || (x->cp != ' ' && x->fg != y->fg))
+            return (long)i;
+    }
+    return -1;
+}
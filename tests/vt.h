@@ -0,0 +1,52 @@
+/* vt.h — A minimal terminal model, as an output sink for tests and
+ * benchmarks
+ *
+ * Parses what libicosa sends — UTF-8 text, LF (as CR LF, the way the tty
+ * translates it), CR, and the CSI sequences CUP, CUF, ED, EL, ECH, REP,
+ * SGR and private modes (ignored) — into a grid of cells, counting the
+ * work a real terminal would do. Erases fill with the current background,
+ * as terminals with BCE do.
+ */
+#ifndef VT_H
+#define VT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VT_DEFAULT (-1) /* fg/bg: the terminal's own color */
+
+struct vt_cell {
+    uint32_t cp;     /* code point */
+    int32_t fg, bg;  /* 0-255, 0x1000000|rgb for truecolor, or VT_DEFAULT */
+};
+
+struct vt {
+    int cols, rows;
+    struct vt_cell *cells;
+    int x, y, wrap;      /* cursor, and a wrap pending at the right edge */
+    int32_t fg, bg;      /* current SGR colors */
+    uint32_t last;       /* last printed character, for REP */
+
+    /* Parser */
+    int state;
+    unsigned params[16];
+    int nparams, priv;
+    uint32_t utf8;
+    int utf8_need;
+
+    /* Work done */
+    uint64_t bytes;      /* bytes parsed */
+    uint64_t seqs;       /* control sequences and controls acted on */
+    uint64_t prints;     /* characters printed */
+    uint64_t cell_writes; /* cells written, by printing, REP or erasing */
+};
+
+int vt_init(struct vt *t, int cols, int rows);
+void vt_free(struct vt *t);
+void vt_feed(struct vt *t, const char *p, size_t n);
+
+/* Index of the first cell where two same-size screens look different, or
+ * -1. The foreground of a blank cell doesn't show, so it isn't compared. */
+long vt_compare(const struct vt *a, const struct vt *b);
+
+#endif